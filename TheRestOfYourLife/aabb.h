@@ -12,58 +12,66 @@
 //==============================================================================================
 
 
-class aabb {
+template <typename T>
+class basic_aabb {
   public:
-    interval x, y, z;
+    basic_interval<T> x, y, z;
 
-    aabb() {} // The default AABB is empty, since intervals are empty by default.
+    basic_aabb() {} // The default AABB is empty, since intervals are empty by default.
 
-    aabb(const interval& x, const interval& y, const interval& z)
+    basic_aabb(
+        const basic_interval<T>& x, const basic_interval<T>& y, const basic_interval<T>& z
+    )
       : x(x), y(y), z(z)
     {
         pad_to_minimums();
     }
 
-    aabb(const point3& a, const point3& b) {
+    basic_aabb(const basic_vec3<T>& a, const basic_vec3<T>& b) {
         // Treat the two points a and b as extrema for the bounding box, so we don't require a
         // particular minimum/maximum coordinate order.
 
-        x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
-        y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
-        z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
+        using span = basic_interval<T>;
+        x = (a[0] <= b[0]) ? span(a[0], b[0]) : span(b[0], a[0]);
+        y = (a[1] <= b[1]) ? span(a[1], b[1]) : span(b[1], a[1]);
+        z = (a[2] <= b[2]) ? span(a[2], b[2]) : span(b[2], a[2]);
 
         pad_to_minimums();
     }
 
-    aabb(const aabb& box0, const aabb& box1) {
-        x = interval(box0.x, box1.x);
-        y = interval(box0.y, box1.y);
-        z = interval(box0.z, box1.z);
+    basic_aabb(const basic_aabb& box0, const basic_aabb& box1) {
+        x = basic_interval<T>(box0.x, box1.x);
+        y = basic_interval<T>(box0.y, box1.y);
+        z = basic_interval<T>(box0.z, box1.z);
     }
 
-    const interval& axis_interval(int n) const {
+    const basic_interval<T>& axis_interval(int n) const {
         if (n == 1) return y;
         if (n == 2) return z;
         return x;
     }
 
-    bool hit(const ray& r, interval ray_t) const {
-        const point3& ray_orig = r.origin();
-        const vec3&   ray_dir  = r.direction();
+    bool hit(const basic_ray<T>& r, basic_interval<T> ray_t) const {
+        // Each exit distance is scaled up by a few units in the last place, so rounding can't
+        // place it before the entry of a box that the ray does pass through. That matters for
+        // flat boxes, whose padding is only a few units in the last place in single precision.
+
+        const basic_vec3<T>& ray_orig = r.origin();
+        const basic_vec3<T>& ray_dir  = r.direction();
 
         for (int axis = 0; axis < 3; axis++) {
-            const interval& ax = axis_interval(axis);
-            const double adinv = 1.0 / ray_dir[axis];
+            const basic_interval<T>& ax = axis_interval(axis);
+            const T adinv = T(1) / ray_dir[axis];
 
             auto t0 = (ax.min - ray_orig[axis]) * adinv;
             auto t1 = (ax.max - ray_orig[axis]) * adinv;
 
             if (t0 < t1) {
                 if (t0 > ray_t.min) ray_t.min = t0;
-                if (t1 < ray_t.max) ray_t.max = t1;
+                if (t1 * robust_scale < ray_t.max) ray_t.max = t1 * robust_scale;
             } else {
                 if (t1 > ray_t.min) ray_t.min = t1;
-                if (t0 < ray_t.max) ray_t.max = t0;
+                if (t0 * robust_scale < ray_t.max) ray_t.max = t0 * robust_scale;
             }
 
             if (ray_t.max <= ray_t.min)
@@ -72,6 +80,10 @@ class aabb {
         return true;
     }
 
+    T surface_area() const {
+        return 2 * (x.size()*y.size() + y.size()*z.size() + z.size()*x.size());
+    }
+
     int longest_axis() const {
         // Returns the index of the longest axis of the bounding box.
 
@@ -81,28 +93,41 @@ class aabb {
             return y.size() > z.size() ? 1 : 2;
     }
 
-    static const aabb empty, universe;
+    static const basic_aabb empty, universe;
 
   private:
+    static constexpr T robust_scale = 1 + 4 * std::numeric_limits<T>::epsilon();
 
     void pad_to_minimums() {
         // Adjust the AABB so that no side is narrower than some delta, padding if necessary.
 
-        double delta = 0.0001;
+        T delta = 0.0001;
         if (x.size() < delta) x = x.expand(delta);
         if (y.size() < delta) y = y.expand(delta);
         if (z.size() < delta) z = z.expand(delta);
     }
 };
 
-const aabb aabb::empty    = aabb(interval::empty,    interval::empty,    interval::empty);
-const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
-
-aabb operator+(const aabb& bbox, const vec3& offset) {
-    return aabb(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
+// Static members of class templates are initialized in no particular order, so these are
+// built from infinity rather than from basic_interval's empty and universe.
+template <typename T>
+const basic_aabb<T> basic_aabb<T>::empty = basic_aabb<T>(
+    basic_interval<T>(+infinity, -infinity), basic_interval<T>(+infinity, -infinity),
+    basic_interval<T>(+infinity, -infinity));
+template <typename T>
+const basic_aabb<T> basic_aabb<T>::universe = basic_aabb<T>(
+    basic_interval<T>(-infinity, +infinity), basic_interval<T>(-infinity, +infinity),
+    basic_interval<T>(-infinity, +infinity));
+
+using aabb = basic_aabb<real>;
+
+template <typename T>
+basic_aabb<T> operator+(const basic_aabb<T>& bbox, const basic_vec3<T>& offset) {
+    return basic_aabb<T>(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
 }
 
-aabb operator+(const vec3& offset, const aabb& bbox) {
+template <typename T>
+basic_aabb<T> operator+(const basic_vec3<T>& offset, const basic_aabb<T>& bbox) {
     return bbox + offset;
 }
 
@@ -0,0 +1,312 @@
+#ifndef BENCH_SCENES_H
+#define BENCH_SCENES_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// The scenes the benchmarks run on, and the helpers they use to save, load and compare the
+// images they render.
+
+#include "camera.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+struct bench_scene {
+    const char*   name;
+    const char*   file_name;  // Names the images a benchmark saves
+    hittable_list world;      // The bare primitives; each benchmark picks its accelerator
+    hittable_list lights;
+    camera        cam;        // The view only; each benchmark sets the sampling
+};
+
+
+inline bench_scene bouncing_spheres(int extent = 11) {
+    // The final scene of TheNextWeek. The small spheres cover a grid of 2*extent by 2*extent
+    // cells. The scene is lit by the sky alone, so light samples aim at a patch of it overhead.
+
+    bench_scene scene{"bouncing spheres", "bouncing_spheres", {}, {}, {}};
+    auto& world = scene.world;
+
+    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(checker)));
+
+    for (int a = -extent; a < extent; a++) {
+        for (int b = -extent; b < extent; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_shared<lambertian>(albedo);
+                    auto center2 = center + vec3(0, random_double(0,.5), 0);
+                    world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = make_shared<metal>(albedo, fuzz);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                } else {
+                    // glass
+                    sphere_material = make_shared<dielectric>(1.5);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_shared<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    scene.lights.add(make_shared<sphere>(point3(0, 100, 0), 30, shared_ptr<material>()));
+
+    auto& cam = scene.cam;
+    cam.aspect_ratio  = 16.0 / 9.0;
+    cam.image_width   = 400;
+    cam.background    = color(0.70, 0.80, 1.00);
+    cam.vfov          = 20;
+    cam.lookfrom      = point3(13,2,3);
+    cam.lookat        = point3(0,0,0);
+    cam.defocus_angle = 0.6;
+
+    return scene;
+}
+
+
+inline bench_scene cornell_box() {
+    // The Cornell box from restLife.cc.
+
+    bench_scene scene{"cornell box", "cornell_box", {}, {}, {}};
+    auto& world = scene.world;
+
+    auto red   = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+    world.add(make_shared<quad>(point3(555,0,0), vec3(0,0,555), vec3(0,555,0), green));
+    world.add(make_shared<quad>(point3(0,0,555), vec3(0,0,-555), vec3(0,555,0), red));
+    world.add(make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,0,-555), white));
+    world.add(make_shared<quad>(point3(555,0,555), vec3(-555,0,0), vec3(0,555,0), white));
+    world.add(make_shared<quad>(point3(213,554,227), vec3(130,0,0), vec3(0,0,105), light));
+
+    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265,0,295));
+    world.add(box1);
+
+    world.add(make_shared<sphere>(point3(190,90,190), 90, make_shared<dielectric>(1.5)));
+
+    auto m = shared_ptr<material>();
+    scene.lights.add(make_shared<quad>(point3(343,554,332), vec3(-130,0,0), vec3(0,0,-105), m));
+    scene.lights.add(make_shared<sphere>(point3(190, 90, 190), 90, m));
+
+    auto& cam = scene.cam;
+    cam.aspect_ratio = 1.0;
+    cam.image_width  = 200;
+    cam.background   = color(0,0,0);
+    cam.vfov         = 40;
+    cam.lookfrom     = point3(278, 278, -800);
+    cam.lookat       = point3(278, 278, 0);
+
+    return scene;
+}
+
+
+inline bench_scene snowman() {
+    // The first view of snowman.cc.
+
+    bench_scene scene{"snowman", "snowman", {}, {}, {}};
+    auto& world = scene.world;
+
+    auto sun = make_shared<sphere>(point3(-15, 70, -9), 40,
+                                   make_shared<diffuse_light>(color(3, 2.5, 2)));
+    world.add(sun);
+    scene.lights.add(sun);
+
+    auto sky_box = make_shared<lambertian>(color(0.5, 0.7, 1.0));
+    world.add(make_shared<quad>(point3(-40, -5, 15), vec3(0, 0, -50), vec3(0, 30, 0), sky_box));
+
+    auto ground_material = make_shared<snow>();
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+    world.add(make_shared<sphere>(point3(-8,-2,-4), 3, ground_material));
+    world.add(make_shared<sphere>(point3(-10,-3,-10), 5, ground_material));
+    world.add(make_shared<sphere>(point3(-6, 0, 6), 2, ground_material));
+    world.add(make_shared<sphere>(point3(-3, -0.5, 8), 1, ground_material));
+    world.add(make_shared<sphere>(point3(-3, -3, 6), 5, ground_material));
+    world.add(make_shared<sphere>(point3(-13, -5, 7), 8, ground_material));
+    world.add(make_shared<sphere>(point3(-3, -2, 5), 4, ground_material));
+    world.add(make_shared<sphere>(point3(-3, -0.4, -1), 1, ground_material));
+
+    auto snowballs = make_shared<snowball>();
+    world.add(make_shared<sphere>(point3(-5, 0.55, 0), 0.6, snowballs));
+    world.add(make_shared<sphere>(point3(-5, 1.3, 0), 0.4, snowballs));
+    world.add(make_shared<sphere>(point3(-5, 1.8, 0), 0.3, snowballs));
+
+    auto stones = make_shared<rock>();
+    world.add(make_shared<sphere>(point3(-4.4, 0.55, 0), 0.1, stones));
+    world.add(make_shared<sphere>(point3(-4.6, 1.3, 0), 0.1, stones));
+    world.add(make_shared<sphere>(point3(-4.8, 1.9, 0.2), 0.1, stones));
+    world.add(make_shared<sphere>(point3(-4.8, 1.9, -0.2), 0.1, stones));
+
+    auto& cam = scene.cam;
+    cam.aspect_ratio  = 16.0 / 9.0;
+    cam.image_width   = 240;
+    cam.background    = color(0.70, 0.80, 1.00);
+    cam.vfov          = 20;
+    cam.lookfrom      = point3(13,2,3);
+    cam.lookat        = point3(0,2,0);
+    cam.defocus_angle = 0.6;
+    cam.focus_dist    = 15.0;
+
+    return scene;
+}
+
+
+inline bench_scene showcase(bool fog = true) {
+    // The test.cc showcase, with a gray floor in place of the rock texture. Without its fog,
+    // the scene has no random hits, so repeated traces of a ray agree.
+
+    bench_scene scene{"showcase", "showcase", {}, {}, {}};
+    auto& world = scene.world;
+
+    auto ground = make_shared<lambertian>(color(0.4, 0.4, 0.4));
+    auto sky_blue = make_shared<lambertian>(color(0.53, 0.81, 0.92));
+    auto magenta_metal = make_shared<metal>(color(0.8, 0.05, 0.8), 0.1);
+    auto gold_metal = make_shared<metal>(color(0.8, 0.6, 0.2), 0.05);
+    auto glass = make_shared<dielectric>(1.5);
+    auto cyan = make_shared<lambertian>(color(0.05, 0.85, 0.9));
+    auto marble = make_shared<lambertian>(make_shared<noise_texture>(4));
+    auto checker = make_shared<lambertian>(
+        make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)));
+    auto light = make_shared<diffuse_light>(color(25, 25, 25));
+
+    auto floor_q = point3(-1000,0,1000);
+    auto left_q  = point3(-1000,0,-1000);
+    auto right_q = point3(1000,0,1000);
+    world.add(make_shared<quad>(floor_q, vec3(2000,0,0), vec3(0,0,-2000), ground));
+    world.add(make_shared<quad>(floor_q, vec3(0,2000,0), vec3(2000,0,0), sky_blue));
+    world.add(make_shared<quad>(left_q, vec3(0,2000,0), vec3(0,0,2000), sky_blue));
+    world.add(make_shared<quad>(right_q, vec3(0,2000,0), vec3(0,0,-2000), sky_blue));
+    world.add(make_shared<quad>(point3(-200,554,-200), vec3(400,0,0), vec3(0,0,400), light));
+
+    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), magenta_metal);
+    box1 = make_shared<rotate_y>(box1, 20);
+    box1 = make_shared<translate>(box1, vec3(150, 0, -150));
+    world.add(box1);
+
+    world.add(make_shared<sphere>(point3(-200, 120, 100), 120, glass));
+    world.add(make_shared<sphere>(point3(0, 80, 150), 80, marble));
+    world.add(make_shared<sphere>(point3(350, 70, 50), 70, checker));
+
+    shared_ptr<hittable> box2 = box(point3(0,0,0), point3(100,100,100), gold_metal);
+    box2 = make_shared<rotate_y>(box2, -30);
+    box2 = make_shared<translate>(box2, vec3(380, 0, 250));
+    world.add(box2);
+
+    world.add(make_shared<sphere>(point3(-350, 250, -180), 100, cyan));
+
+    if (fog) {
+        auto fog_boundary = box(point3(130, -1, -170), point3(400, 340, 270), glass);
+        world.add(make_shared<constant_medium>(fog_boundary, 0.001, color(1.0, 1.0, 1.0)));
+    }
+
+    auto m = shared_ptr<material>();
+    scene.lights.add(make_shared<quad>(point3(-200,554,-200), vec3(400,0,0), vec3(0,0,400), m));
+
+    auto& cam = scene.cam;
+    cam.aspect_ratio  = 16.0 / 9.0;
+    cam.image_width   = 240;
+    cam.background    = color(0.53, 0.81, 0.92);
+    cam.vfov          = 80;
+    cam.lookfrom      = point3(0, 250, -600);
+    cam.lookat        = point3(0, 120, 0);
+    cam.defocus_angle = 0.2;
+    cam.focus_dist    = 650.0;
+
+    return scene;
+}
+
+
+// Images
+
+inline void save_image(const std::string& path, const std::vector<color>& image) {
+    // Writes three doubles per pixel, whatever the precision and layout of color, so that any
+    // build can read the images of any other.
+    std::ofstream out(path, std::ios::binary);
+    for (const auto& c : image) {
+        double values[3] = {c.x(), c.y(), c.z()};
+        out.write(reinterpret_cast<const char*>(values), sizeof(values));
+    }
+}
+
+
+inline bool load_image(const std::string& path, size_t pixels, std::vector<color>& image) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+
+    image.clear();
+    for (size_t i = 0; i < pixels; i++) {
+        double values[3];
+        if (!in.read(reinterpret_cast<char*>(values), sizeof(values)))
+            return false;
+        image.push_back(color(values[0], values[1], values[2]));
+    }
+    return true;
+}
+
+
+inline double mean_value(const std::vector<color>& image) {
+    double sum = 0;
+    for (const auto& c : image)
+        sum += double(c.x()) + c.y() + c.z();
+    return sum / (3.0 * image.size());
+}
+
+
+inline double rms_difference(const std::vector<color>& a, const std::vector<color>& b) {
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        sum += (a[i] - b[i]).length_squared();
+    return std::sqrt(sum / (3.0 * a.size()));
+}
+
+
+inline double mean_abs_difference(const std::vector<color>& a, const std::vector<color>& b) {
+    // Less dominated by a few fireflies than the RMS difference.
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        auto d = a[i] - b[i];
+        sum += double(std::fabs(d.x())) + std::fabs(d.y()) + std::fabs(d.z());
+    }
+    return sum / (3.0 * a.size());
+}
+
+
+#endif
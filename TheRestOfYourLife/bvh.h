@@ -14,8 +14,17 @@
 #include "aabb.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "simd.h"
+#include "sphere.h"
+#include "thread_pool.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
 
 
 class bvh_node : public hittable {
@@ -65,6 +74,10 @@ class bvh_node : public hittable {
         return hit_left || hit_right;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        return bbox.hit(r, ray_t) && (left->occluded(r, ray_t) || right->occluded(r, ray_t));
+    }
+
     aabb bounding_box() const override { return bbox; }
 
   private:
@@ -94,4 +107,1001 @@ class bvh_node : public hittable {
 };
 
 
+enum class bvh_split {
+    object_median,  // Halve the primitives along the axis of largest centroid spread
+    sah             // Binned surface area heuristic
+};
+
+
+struct bvh_build_options {
+    bvh_split split          = bvh_split::sah;
+    int    bin_count         = 16;   // SAH buckets along the split axis (2 to 64)
+    int    max_leaf_size     = 4;    // Larger spans are always split (at most 255)
+    double traversal_cost    = 0.5;  // SAH cost of visiting an interior node ...
+    double intersection_cost = 1.0;  // ... relative to testing one primitive
+    bool   sphere_blocks     = true; // wide_bvh: turn small subtrees of spheres into blocks
+};
+
+
+struct bvh_stats {
+    size_t primitives    = 0;
+    size_t nodes         = 0;
+    size_t leaves        = 0;
+    int    max_depth     = 0;
+    double sah_cost      = 0;  // Expected cost of a random ray through the root box
+    double build_seconds = 0;  // Wall clock time of the build
+};
+
+inline std::ostream& operator<<(std::ostream& out, const bvh_stats& stats) {
+    return out << stats.primitives << " primitives, " << stats.nodes << " nodes, "
+               << stats.leaves << " leaves ("
+               << (stats.leaves ? double(stats.primitives) / stats.leaves : 0.0)
+               << " prims/leaf), depth " << stats.max_depth << ", SAH cost " << stats.sah_cost
+               << ", built in " << stats.build_seconds << " s";
+}
+
+
+struct traversal_counts {
+    // The work done by hit_counted() calls, for comparing acceleration structures.
+    long long rays       = 0;
+    long long nodes      = 0;  // Node visits: one box test in linear_bvh, four in wide_bvh
+    long long primitives = 0;  // Primitive hit tests
+};
+
+
+struct alignas(32) linear_bvh_node {
+    // One node of a flattened BVH, sized and aligned to 32 bytes so two nodes share a cache
+    // line. Bounds are stored as floats rounded outward, so they never shrink the double
+    // precision box they came from. An interior node's first child immediately follows it in
+    // the node array; the second child's index is stored in `offset`.
+
+    float    bounds_min[3];
+    float    bounds_max[3];
+    uint32_t offset;  // Leaf: index of the first primitive. Interior: index of second child.
+    uint16_t count;   // Number of primitives in a leaf; 0 for an interior node
+    uint8_t  axis;    // Split axis of an interior node
+    uint8_t  pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill exactly 32 bytes");
+
+
+class linear_bvh : public hittable {
+  // A BVH compiled into a contiguous node array. Traversal is an iterative loop over node
+  // indices with a small explicit stack, visiting the child on the near side of the split
+  // first. Only the primitives themselves are reached through virtual calls.
+  public:
+    linear_bvh(
+        const hittable_list& list, const bvh_build_options& options = {},
+        thread_pool* pool = nullptr
+    ) : options(options)
+    {
+        // Subtrees are built as parallel tasks on the given pool. Without one, large inputs
+        // get a temporary pool for the duration of the build and small ones build inline.
+
+        auto start_time = std::chrono::steady_clock::now();
+
+        this->options.bin_count = std::max(2, std::min(options.bin_count, max_bins));
+        this->options.max_leaf_size = std::max(1, std::min(options.max_leaf_size, 255));
+
+        auto n = list.objects.size();
+
+        std::unique_ptr<thread_pool> own_pool;
+        if (!pool && n >= parallel_build_size) {
+            own_pool = std::make_unique<thread_pool>();
+            pool = own_pool.get();
+        }
+
+        std::vector<build_primitive> build_prims(n);
+        for_chunks(pool, n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                auto box = list.objects[i]->bounding_box();
+                auto centroid = point3(
+                    0.5 * (box.x.min + box.x.max),
+                    0.5 * (box.y.min + box.y.max),
+                    0.5 * (box.z.min + box.z.max)
+                );
+                build_prims[i] = {box, centroid, i};
+            }
+        });
+
+        if (n > 0) {
+            auto root = build(pool, build_prims, 0, n, 0);
+
+            // Leaves refer to runs of build_prims, whose final order is the primitive order.
+            primitives.resize(n);
+            for_chunks(pool, n, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                    primitives[i] = list.objects[build_prims[i].index];
+            });
+
+            nodes.reserve(2 * n);
+            flatten(*root);
+        }
+
+        bbox = list.bounding_box();
+
+        auto stop_time = std::chrono::steady_clock::now();
+        build_seconds = std::chrono::duration<double>(stop_time - start_time).count();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return traverse<false>(r, ray_t, rec, nullptr);
+    }
+
+    bool hit_counted(
+        const ray& r, interval ray_t, hit_record& rec, traversal_counts& counts
+    ) const {
+        // hit(), adding the nodes and primitives it visits to counts.
+        return traverse<true>(r, ray_t, rec, &counts);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        hit_record rec;  // Left alone by an any-hit traversal
+        return traverse<false, true>(r, ray_t, rec, nullptr);
+    }
+
+    void hit_packet(
+        const ray_packet& packet, uint32_t lanes, packet_hits& hits
+    ) const override {
+        // Walks the tree once for all the rays of the packet. Every node is tested against
+        // all the rays at once, and a subtree is skipped as soon as none of them hits its box.
+        // Children are visited in the order that suits the first ray, which coherent rays
+        // share. Each ray still tests only the primitives in the boxes it hits, up to its own
+        // closest hit, so it finds the same hit as it would on its own.
+
+        if (nodes.empty() || lanes == 0)
+            return;
+
+        auto t_min = float(hits.t_min);
+        float t_max[packet_size];
+        for (int k = 0; k < packet_size; k++)
+            t_max[k] = float(hits.t_max[k]);
+
+        int first = 0;
+        while (!(lanes & (1u << first)))
+            first++;
+        const bool dir_is_neg[3] = {
+            packet.inv_direction[0][first] < 0,
+            packet.inv_direction[1][first] < 0,
+            packet.inv_direction[2][first] < 0
+        };
+
+        uint32_t stack[max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        while (true) {
+            const auto& node = nodes[current];
+            auto active = packet_node_hit(node, packet, lanes, t_min, t_max);
+
+            if (active) {
+                if (node.count > 0) {
+                    for (uint32_t i = 0; i < node.count; i++)
+                        primitives[node.offset + i]->hit_packet(packet, active, hits);
+                    for (int k = 0; k < packet_size; k++) {
+                        if (active & (1u << k))
+                            t_max[k] = float(hits.t_max[k]);
+                    }
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                } else if (dir_is_neg[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+            } else {
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    bvh_stats stats() const {
+        // Walks the tree to report its shape and SAH cost. The cost is the expected work
+        // (in units of primitive tests) for a ray that passes through the root box.
+
+        bvh_stats result;
+        result.primitives = primitives.size();
+        result.nodes = nodes.size();
+        result.build_seconds = build_seconds;
+        if (nodes.empty())
+            return result;
+
+        auto root_area = node_area(nodes[0]);
+
+        std::vector<std::pair<uint32_t, int>> pending = {{0, 1}};
+        while (!pending.empty()) {
+            auto [index, depth] = pending.back();
+            pending.pop_back();
+
+            const auto& node = nodes[index];
+            auto weight = node_area(node) / root_area;
+            result.max_depth = std::max(result.max_depth, depth);
+
+            if (node.count > 0) {
+                result.leaves++;
+                result.sah_cost += weight * options.intersection_cost * node.count;
+            } else {
+                result.sah_cost += weight * options.traversal_cost;
+                pending.push_back({index + 1, depth + 1});
+                pending.push_back({node.offset, depth + 1});
+            }
+        }
+
+        return result;
+    }
+
+  private:
+    struct build_primitive {
+        aabb box;
+        point3 centroid;
+        size_t index;
+    };
+
+    struct build_node {
+        aabb box;
+        int axis = 0;
+        size_t start = 0;  // Leaf: run of build primitives, in their final order
+        size_t count = 0;
+        std::unique_ptr<build_node> children[2];  // Both empty for a leaf
+    };
+
+    struct sah_bin {
+        aabb box = aabb::empty;
+        size_t count = 0;
+    };
+
+    static constexpr int max_depth = 64;  // Traversal stack size, and the build depth limit
+    static constexpr size_t max_leaf_count = 0x7fff;  // Leaves below wide_bvh's block flag
+    static constexpr int max_bins = 64;
+    static constexpr size_t chunk_size = 16384;            // Primitives per parallel pass chunk
+    static constexpr size_t parallel_subtree_size = 4096;  // Smaller subtrees build inline
+    static constexpr size_t parallel_build_size = 65536;   // Smaller inputs build inline
+    static constexpr float robust_scale = 1.0f + 4 * std::numeric_limits<float>::epsilon();
+
+    friend class wide_bvh;  // Collapses the tree into wide nodes
+
+    std::vector<linear_bvh_node> nodes;
+    std::vector<shared_ptr<hittable>> primitives;  // Ordered so every leaf is a contiguous run
+    bvh_build_options options;
+    aabb bbox;
+    double build_seconds = 0;
+
+    template <bool counting, bool any_hit = false>
+    bool traverse(
+        const ray& r, interval ray_t, hit_record& rec, traversal_counts* counts
+    ) const {
+        // The traversal behind hit(), hit_counted() and occluded(). The counting compiles away
+        // in hit(). An any-hit traversal returns at the first primitive the ray hits.
+
+        if constexpr (counting)
+            counts->rays++;
+        if (nodes.empty())
+            return false;
+
+        const point3& ray_orig = r.origin();
+        const vec3&   ray_dir  = r.direction();
+
+        const float orig[3] = { float(ray_orig.x()), float(ray_orig.y()), float(ray_orig.z()) };
+        const float inv_dir[3] = {
+            float(1.0 / ray_dir.x()), float(1.0 / ray_dir.y()), float(1.0 / ray_dir.z())
+        };
+        const bool dir_is_neg[3] = { inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0 };
+
+        uint32_t stack[max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+        bool hit_anything = false;
+
+        while (true) {
+            const auto& node = nodes[current];
+            if constexpr (counting)
+                counts->nodes++;
+
+            if (node_hit(node, orig, inv_dir, dir_is_neg, float(ray_t.min), float(ray_t.max))) {
+                if (node.count > 0) {
+                    if constexpr (counting)
+                        counts->primitives += node.count;
+                    for (uint32_t i = 0; i < node.count; i++) {
+                        const auto& primitive = primitives[node.offset + i];
+                        if constexpr (any_hit) {
+                            if (primitive->occluded(r, ray_t))
+                                return true;
+                        } else if (primitive->hit(r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                } else if (dir_is_neg[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+            } else {
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+        }
+
+        return hit_anything;
+    }
+
+    static bool node_hit(
+        const linear_bvh_node& node, const float orig[3], const float inv_dir[3],
+        const bool dir_is_neg[3], float t_min, float t_max
+    ) {
+        // Slab test in single precision against the outward-rounded float bounds. The far
+        // distance is scaled up by a few ulps so rounding in the test itself can't make a ray
+        // miss a box that it grazes. The loop has no early exit so it compiles branch-free.
+
+        for (int axis = 0; axis < 3; axis++) {
+            float near = dir_is_neg[axis] ? node.bounds_max[axis] : node.bounds_min[axis];
+            float far  = dir_is_neg[axis] ? node.bounds_min[axis] : node.bounds_max[axis];
+
+            float t0 = (near - orig[axis]) * inv_dir[axis];
+            float t1 = (far  - orig[axis]) * inv_dir[axis] * robust_scale;
+
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+        }
+        return t_min <= t_max;
+    }
+
+    static uint32_t packet_node_hit(
+        const linear_bvh_node& node, const ray_packet& packet, uint32_t lanes, float t_min,
+        const float t_max[]
+    ) {
+        // The slab test of node_hit for the given rays of the packet, a SIMD register of rays
+        // at a time. Returns the mask of the rays that hit the box.
+
+        auto scale = vfloat::broadcast(robust_scale);
+        uint32_t result = 0;
+
+        for (int k = 0; k < packet_size; k += vfloat::width) {
+            constexpr uint32_t chunk = (1u << vfloat::width) - 1;
+            if (!((lanes >> k) & chunk))
+                continue;
+
+            auto near_t = vfloat::broadcast(t_min);
+            auto far_t = vfloat::load(t_max + k);
+
+            for (int axis = 0; axis < 3; axis++) {
+                auto orig = vfloat::load(packet.float_origin[axis] + k);
+                auto inv_dir = vfloat::load(packet.inv_direction[axis] + k);
+                auto box_min = vfloat::broadcast(node.bounds_min[axis]);
+                auto box_max = vfloat::broadcast(node.bounds_max[axis]);
+
+                auto near = select_negative(inv_dir, box_max, box_min);
+                auto far  = select_negative(inv_dir, box_min, box_max);
+
+                auto t0 = (near - orig) * inv_dir;
+                auto t1 = (far  - orig) * inv_dir * scale;
+
+                near_t = max(t0, near_t);
+                far_t  = min(t1, far_t);
+            }
+
+            result |= less_equal_mask(near_t, far_t) << k;
+        }
+
+        return result & lanes;
+    }
+
+    static float round_down(double x) {
+        auto f = float(x);
+        return (double(f) > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float round_up(double x) {
+        auto f = float(x);
+        return (double(f) < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    uint32_t flatten(const build_node& node) {
+        // Emits the build tree in depth-first order, so every first child directly follows
+        // its parent.
+
+        auto index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        if (node.children[0]) {
+            flatten(*node.children[0]);
+            auto second = flatten(*node.children[1]);
+            nodes[index].offset = second;
+            nodes[index].count = 0;
+            nodes[index].axis = uint8_t(node.axis);
+        } else {
+            nodes[index].offset = uint32_t(node.start);
+            nodes[index].count = uint16_t(node.count);
+            nodes[index].axis = 0;
+        }
+
+        set_bounds(nodes[index], node.box);
+        return index;
+    }
+
+    std::unique_ptr<build_node> build(
+        thread_pool* pool, std::vector<build_primitive>& prims, size_t start, size_t end,
+        int depth
+    ) const {
+        // Sibling subtrees cover disjoint runs of prims, so large ones are built as separate
+        // tasks. The linear passes over very large runs near the root are split into chunks
+        // as well, since they would otherwise run alone while the rest of the pool waits.
+
+        auto node = std::make_unique<build_node>();
+
+        aabb centroid_box;
+        span_bounds(pool, prims, start, end, node->box, centroid_box);
+
+        // Splits stop at the depth limit, but only once the span fits in one leaf. A span that
+        // is still too large keeps enough depth in reserve to be halved by median splits.
+        int axis = centroid_box.longest_axis();
+        auto reserve = median_levels(end - start);
+        size_t mid = start;
+        if (depth + reserve < max_depth - 1)
+            mid = choose_split(pool, prims, start, end, node->box, centroid_box, axis);
+        else if (reserve > 0)
+            mid = split_at_median(prims, start, end, axis);
+
+        if (mid == start) {
+            node->start = start;
+            node->count = end - start;
+            return node;
+        }
+
+        node->axis = axis;
+
+        if (pool && end - start >= parallel_subtree_size) {
+            task_group first_half;
+            pool->run(first_half, [&] {
+                node->children[0] = build(pool, prims, start, mid, depth + 1);
+            });
+            node->children[1] = build(pool, prims, mid, end, depth + 1);
+            pool->wait(first_half);
+        } else {
+            node->children[0] = build(pool, prims, start, mid, depth + 1);
+            node->children[1] = build(pool, prims, mid, end, depth + 1);
+        }
+
+        return node;
+    }
+
+    static bool runs_in_chunks(thread_pool* pool, size_t count) {
+        return pool && count > chunk_size;
+    }
+
+    static void for_chunks(
+        thread_pool* pool, size_t count, const std::function<void(size_t, size_t)>& body
+    ) {
+        // Runs body over [0,count) in chunks of chunk_size on the pool, or inline in one piece
+        // when the range is small. Chunk k starts at k*chunk_size, which callers use to index
+        // their partial results.
+
+        if (runs_in_chunks(pool, count))
+            pool->parallel_for(count, chunk_size, body);
+        else if (count > 0)
+            body(0, count);
+    }
+
+    static size_t chunks_in(size_t count) { return (count + chunk_size - 1) / chunk_size; }
+
+    static void span_bounds(
+        thread_pool* pool, const std::vector<build_primitive>& prims, size_t start, size_t end,
+        aabb& box, aabb& centroid_box
+    ) {
+        auto accumulate = [&](size_t first, size_t last, aabb& b, aabb& cb) {
+            for (size_t i = first; i < last; i++) {
+                const auto& c = prims[i].centroid;
+                b = aabb(b, prims[i].box);
+                cb = aabb(cb, aabb(c, c));
+            }
+        };
+
+        box = aabb::empty;
+        centroid_box = aabb::empty;
+
+        if (!runs_in_chunks(pool, end - start)) {
+            accumulate(start, end, box, centroid_box);
+            return;
+        }
+
+        std::vector<aabb> boxes(chunks_in(end - start), aabb::empty);
+        std::vector<aabb> centroid_boxes(boxes.size(), aabb::empty);
+        for_chunks(pool, end - start, [&](size_t begin, size_t stop) {
+            auto k = begin / chunk_size;
+            accumulate(start + begin, start + stop, boxes[k], centroid_boxes[k]);
+        });
+
+        for (size_t k = 0; k < boxes.size(); k++) {
+            box = aabb(box, boxes[k]);
+            centroid_box = aabb(centroid_box, centroid_boxes[k]);
+        }
+    }
+
+    size_t choose_split(
+        thread_pool* pool, std::vector<build_primitive>& prims, size_t start, size_t end,
+        const aabb& node_box, const aabb& centroid_box, int axis
+    ) const {
+        // Partitions prims[start,end) and returns the start of the second half, or returns
+        // start to ask for a leaf.
+
+        size_t span = end - start;
+        bool must_split = span > size_t(options.max_leaf_size);
+        if (span <= 1)
+            return start;
+
+        auto cmin = centroid_box.axis_interval(axis).min;
+        auto cmax = centroid_box.axis_interval(axis).max;
+
+        if (options.split == bvh_split::object_median || !(cmax > cmin)) {
+            // Median split (also the fallback when every centroid coincides, so there is
+            // nothing to bin).
+            return must_split ? split_at_median(prims, start, end, axis) : start;
+        }
+
+        // Drop every centroid into one of bin_count equal slices of the centroid range. Each
+        // chunk of a large span fills its own set of bins, merged afterwards.
+        int bin_count = options.bin_count;
+        auto scale = bin_count / (cmax - cmin);
+
+        auto bin_of = [&](const build_primitive& p) {
+            auto b = int((p.centroid[axis] - cmin) * scale);
+            return std::min(b, bin_count - 1);
+        };
+
+        auto fill_bins = [&](size_t first, size_t last, sah_bin* target) {
+            for (size_t i = first; i < last; i++) {
+                auto& b = target[bin_of(prims[i])];
+                b.box = aabb(b.box, prims[i].box);
+                b.count++;
+            }
+        };
+
+        sah_bin bins[max_bins];
+
+        if (!runs_in_chunks(pool, span)) {
+            fill_bins(start, end, bins);
+        } else {
+            std::vector<sah_bin> chunk_bins(chunks_in(span) * bin_count);
+            for_chunks(pool, span, [&](size_t begin, size_t stop) {
+                auto target = &chunk_bins[(begin / chunk_size) * bin_count];
+                fill_bins(start + begin, start + stop, target);
+            });
+
+            for (size_t k = 0; k < chunk_bins.size(); k++) {
+                auto& b = bins[k % bin_count];
+                b.box = aabb(b.box, chunk_bins[k].box);
+                b.count += chunk_bins[k].count;
+            }
+        }
+
+        // Sweep from the right to get the area and count above every boundary, then sweep
+        // from the left and evaluate the SAH cost of splitting at each boundary.
+        double right_area[max_bins];
+        size_t right_count[max_bins];
+        aabb right_box = aabb::empty;
+        size_t count_above = 0;
+        for (int b = bin_count - 1; b > 0; b--) {
+            right_box = aabb(right_box, bins[b].box);
+            count_above += bins[b].count;
+            right_area[b] = count_above ? right_box.surface_area() : 0;
+            right_count[b] = count_above;
+        }
+
+        auto inv_area = 1.0 / node_box.surface_area();
+        double best_cost = std::numeric_limits<double>::infinity();
+        int best_split = -1;
+
+        aabb left_box = aabb::empty;
+        size_t count_below = 0;
+        for (int b = 0; b < bin_count - 1; b++) {
+            left_box = aabb(left_box, bins[b].box);
+            count_below += bins[b].count;
+
+            if (count_below == 0 || right_count[b+1] == 0)
+                continue;
+
+            auto cost = options.traversal_cost
+                      + options.intersection_cost * inv_area
+                        * (count_below * left_box.surface_area()
+                           + right_count[b+1] * right_area[b+1]);
+
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = b;
+            }
+        }
+
+        auto leaf_cost = options.intersection_cost * span;
+        if (best_split < 0 || (!must_split && leaf_cost <= best_cost))
+            return start;
+
+        auto middle = std::partition(
+            prims.begin() + start, prims.begin() + end,
+            [&](const build_primitive& p) { return bin_of(p) <= best_split; });
+
+        return size_t(middle - prims.begin());
+    }
+
+    static size_t split_at_median(
+        std::vector<build_primitive>& prims, size_t start, size_t end, int axis
+    ) {
+        // Partitions prims[start,end) around its median centroid and returns the midpoint.
+        auto mid = start + (end - start)/2;
+        std::nth_element(
+            prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+            [axis](const build_primitive& a, const build_primitive& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+        return mid;
+    }
+
+    static int median_levels(size_t span) {
+        // The number of median splits that leave no more than max_leaf_count primitives in
+        // any leaf. Halving a span leaves at most its rounded-up half on either side.
+        int levels = 0;
+        for (; span > max_leaf_count; span = (span + 1) / 2)
+            levels++;
+        return levels;
+    }
+
+    static double node_area(const linear_bvh_node& node) {
+        double dx = double(node.bounds_max[0]) - node.bounds_min[0];
+        double dy = double(node.bounds_max[1]) - node.bounds_min[1];
+        double dz = double(node.bounds_max[2]) - node.bounds_min[2];
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    }
+
+    static void set_bounds(linear_bvh_node& node, const aabb& box) {
+        for (int axis = 0; axis < 3; axis++) {
+            node.bounds_min[axis] = round_down(box.axis_interval(axis).min);
+            node.bounds_max[axis] = round_up(box.axis_interval(axis).max);
+        }
+    }
+};
+
+
+
+struct alignas(64) wide_bvh_node {
+    // One node of a 4-wide BVH, filling two cache lines. The bounds of the four children are
+    // stored side by side, one array per bound with one lane per child, so a single SIMD slab
+    // test covers all of them. Bounds are the outward-rounded floats of linear_bvh_node.
+    // Unused child slots have inverted bounds, which no ray hits.
+
+    static constexpr uint16_t sphere_block_leaf = 0x8000;  // Flags a count of block spheres
+
+    float    bounds_min[3][4];
+    float    bounds_max[3][4];
+    uint32_t child[4];  // Leaf: index of its first primitive or block. Interior: node index.
+    uint16_t count[4];  // Number of primitives in a leaf child; 0 for an interior child
+    uint8_t  pad[8];
+};
+
+static_assert(sizeof(wide_bvh_node) == 128, "wide_bvh_node should fill exactly 128 bytes");
+
+
+class wide_bvh : public hittable {
+  // A BVH with up to four children per node, made by collapsing the binary tree of a
+  // linear_bvh built with the same options: every node pulls up the children of its largest
+  // interior children until it has four. A ray tests all the children of a node at once and
+  // visits the ones it hits from near to far, skipping those that lie beyond its closest hit
+  // by the time it gets to them. The tree has about a third as many nodes as the binary one,
+  // so a ray visits far fewer of them.
+  //
+  // Subtrees of at least two and at most sphere_block_size spheres become single leaves that
+  // hold the spheres in a sphere_block, unless the build options turn that off.
+  public:
+    wide_bvh(
+        const hittable_list& list, const bvh_build_options& options = {},
+        thread_pool* pool = nullptr
+    ) {
+        auto start_time = std::chrono::steady_clock::now();
+
+        linear_bvh binary(list, options, pool);
+        primitives = std::move(binary.primitives);
+        bbox = binary.bbox;
+        use_sphere_blocks = options.sphere_blocks;
+
+        if (!binary.nodes.empty()) {
+            nodes.reserve(binary.nodes.size() / 2 + 1);
+            // The root's children, or the root itself when the whole tree is one leaf
+            uint32_t root_children[2] = { 1, binary.nodes[0].offset };
+            if (binary.nodes[0].count > 0) {
+                uint32_t leaf = 0;
+                collapse(binary, &leaf, 1);
+            } else {
+                collapse(binary, root_children, 2);
+            }
+        }
+
+        auto stop_time = std::chrono::steady_clock::now();
+        build_seconds = std::chrono::duration<double>(stop_time - start_time).count();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return traverse<false>(r, ray_t, rec, nullptr);
+    }
+
+    bool hit_counted(
+        const ray& r, interval ray_t, hit_record& rec, traversal_counts& counts
+    ) const {
+        // hit(), adding the nodes and primitives it visits to counts.
+        return traverse<true>(r, ray_t, rec, &counts);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        hit_record rec;  // Left alone by an any-hit traversal
+        return traverse<false, true>(r, ray_t, rec, nullptr);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    size_t sphere_block_count() const { return sphere_blocks.size(); }
+
+    double build_time() const { return build_seconds; }
+
+  private:
+    struct stack_entry {
+        uint32_t index;   // As in wide_bvh_node::child
+        uint32_t count;   // As in wide_bvh_node::count
+        float    t_near;  // Where the ray enters the child's box
+    };
+
+    static constexpr int max_depth = 64;  // As for linear_bvh, which bounds the collapsed depth
+    static constexpr int stack_capacity = 3 * max_depth + 4;
+
+    static_assert(linear_bvh::max_leaf_count < wide_bvh_node::sphere_block_leaf,
+                  "leaf counts of the binary tree must leave the sphere block flag clear");
+
+    static constexpr float robust_scale = 1.0f + 4 * std::numeric_limits<float>::epsilon();
+
+    std::vector<wide_bvh_node> nodes;
+    std::vector<shared_ptr<hittable>> primitives;  // Ordered so every leaf is a contiguous run
+    std::vector<sphere_block> sphere_blocks;       // Copies of some of the primitives
+    bool use_sphere_blocks = true;
+    aabb bbox;
+    double build_seconds = 0;
+
+    template <bool counting, bool any_hit = false>
+    bool traverse(
+        const ray& r, interval ray_t, hit_record& rec, traversal_counts* counts
+    ) const {
+        // Children are pushed farthest first, so the nearest is popped next. Every level
+        // leaves at most three siblings on the stack, which bounds its size. An any-hit
+        // traversal returns at the first primitive the ray hits.
+
+        if constexpr (counting)
+            counts->rays++;
+        if (nodes.empty())
+            return false;
+
+        const point3& ray_orig = r.origin();
+        const vec3&   ray_dir  = r.direction();
+
+        vfloat4 orig[3], inv_dir[3];
+        bool dir_is_neg[3];
+        for (int axis = 0; axis < 3; axis++) {
+            auto inv = float(1.0 / ray_dir[axis]);
+            orig[axis] = vfloat4::broadcast(float(ray_orig[axis]));
+            inv_dir[axis] = vfloat4::broadcast(inv);
+            dir_is_neg[axis] = inv < 0;
+        }
+
+        stack_entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = { 0, 0, float(ray_t.min) };
+        bool hit_anything = false;
+
+        while (stack_size > 0) {
+            auto entry = stack[--stack_size];
+            if (entry.t_near > float(ray_t.max))
+                continue;
+
+            if (entry.count & wide_bvh_node::sphere_block_leaf) {
+                const auto& block = sphere_blocks[entry.index];
+                if constexpr (counting)
+                    counts->primitives += block.size();
+                if constexpr (any_hit) {
+                    if (block.occluded(r, ray_t))
+                        return true;
+                } else if (block.hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+                continue;
+            }
+
+            if (entry.count > 0) {
+                if constexpr (counting)
+                    counts->primitives += entry.count;
+                for (uint32_t i = 0; i < entry.count; i++) {
+                    const auto& primitive = primitives[entry.index + i];
+                    if constexpr (any_hit) {
+                        if (primitive->occluded(r, ray_t))
+                            return true;
+                    } else if (primitive->hit(r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+                continue;
+            }
+
+            const auto& node = nodes[entry.index];
+            if constexpr (counting)
+                counts->nodes++;
+
+            float t_near[4];
+            auto mask = node_hit(
+                node, orig, inv_dir, dir_is_neg, float(ray_t.min), float(ray_t.max), t_near);
+
+            // Insert the children that were hit into the top of the stack, sorted so that
+            // distances decrease towards the top.
+            int first = stack_size;
+            for (int k = 0; k < 4; k++) {
+                if (!(mask & (1u << k)))
+                    continue;
+                stack_entry child = { node.child[k], node.count[k], t_near[k] };
+                int slot = stack_size++;
+                while (slot > first && stack[slot - 1].t_near < child.t_near) {
+                    stack[slot] = stack[slot - 1];
+                    slot--;
+                }
+                stack[slot] = child;
+            }
+        }
+
+        return hit_anything;
+    }
+
+    static uint32_t node_hit(
+        const wide_bvh_node& node, const vfloat4 orig[3], const vfloat4 inv_dir[3],
+        const bool dir_is_neg[3], float t_min, float t_max, float t_near[4]
+    ) {
+        // The slab test of linear_bvh::node_hit against all four children at once. Returns
+        // the mask of the children the ray hits, and stores where it enters each of them.
+
+        auto near_t = vfloat4::broadcast(t_min);
+        auto far_t  = vfloat4::broadcast(t_max);
+        auto scale  = vfloat4::broadcast(robust_scale);
+
+        for (int axis = 0; axis < 3; axis++) {
+            auto box_min = vfloat4::load(node.bounds_min[axis]);
+            auto box_max = vfloat4::load(node.bounds_max[axis]);
+            auto near = dir_is_neg[axis] ? box_max : box_min;
+            auto far  = dir_is_neg[axis] ? box_min : box_max;
+
+            auto t0 = (near - orig[axis]) * inv_dir[axis];
+            auto t1 = (far  - orig[axis]) * inv_dir[axis] * scale;
+
+            near_t = max(t0, near_t);
+            far_t  = min(t1, far_t);
+        }
+
+        near_t.store(t_near);
+        return less_equal_mask(near_t, far_t);
+    }
+
+    uint32_t collapse(const linear_bvh& binary, const uint32_t* children, int count) {
+        // Emits a wide node whose children are the given nodes of the binary tree. While
+        // there is room, the interior child with the largest box is replaced by its two
+        // children, which removes the box tests most rays would make. Children that hold few
+        // enough spheres become sphere blocks; other interior children that remain become
+        // wide nodes of their own.
+
+        uint32_t slots[4];
+        bool blocks[4];
+        for (int k = 0; k < count; k++) {
+            slots[k] = children[k];
+            blocks[k] = fits_sphere_block(binary, slots[k]);
+        }
+
+        while (count < 4) {
+            int widest = -1;
+            double widest_area = 0;
+            for (int k = 0; k < count; k++) {
+                const auto& node = binary.nodes[slots[k]];
+                auto area = linear_bvh::node_area(node);
+                if (node.count == 0 && !blocks[k] && (widest < 0 || area > widest_area)) {
+                    widest = k;
+                    widest_area = area;
+                }
+            }
+            if (widest < 0)
+                break;
+
+            auto opened = slots[widest];
+            slots[widest] = opened + 1;
+            slots[count] = binary.nodes[opened].offset;
+            blocks[widest] = fits_sphere_block(binary, slots[widest]);
+            blocks[count] = fits_sphere_block(binary, slots[count]);
+            count++;
+        }
+
+        auto index = uint32_t(nodes.size());
+        nodes.emplace_back();
+        for (int axis = 0; axis < 3; axis++) {
+            for (int k = 0; k < 4; k++) {
+                nodes[index].bounds_min[axis][k] = std::numeric_limits<float>::infinity();
+                nodes[index].bounds_max[axis][k] = -std::numeric_limits<float>::infinity();
+            }
+        }
+
+        for (int k = 0; k < count; k++) {
+            const auto& child = binary.nodes[slots[k]];
+            uint32_t target = child.offset;
+            uint16_t child_count = child.count;
+            if (blocks[k]) {
+                auto [first, end] = primitive_range(binary, slots[k]);
+                target = uint32_t(sphere_blocks.size());
+                child_count = wide_bvh_node::sphere_block_leaf | uint16_t(end - first);
+                sphere_blocks.emplace_back();
+                for (auto i = first; i < end; i++)
+                    sphere_blocks.back().add(static_cast<const sphere&>(*primitives[i]));
+            } else if (child.count == 0) {
+                uint32_t grandchildren[2] = { slots[k] + 1, child.offset };
+                target = collapse(binary, grandchildren, 2);
+            }
+
+            auto& node = nodes[index];  // collapse() may have moved the array
+            for (int axis = 0; axis < 3; axis++) {
+                node.bounds_min[axis][k] = child.bounds_min[axis];
+                node.bounds_max[axis][k] = child.bounds_max[axis];
+            }
+            node.child[k] = target;
+            node.count[k] = child_count;
+        }
+        for (int k = count; k < 4; k++) {
+            nodes[index].child[k] = 0;
+            nodes[index].count[k] = 0;
+        }
+
+        return index;
+    }
+
+    static std::pair<uint32_t, uint32_t> primitive_range(
+        const linear_bvh& binary, uint32_t index
+    ) {
+        // The run of primitives under a node of the binary tree, which starts at its leftmost
+        // leaf and ends with its rightmost one.
+
+        auto first = index, last = index;
+        while (binary.nodes[first].count == 0)
+            first = first + 1;
+        while (binary.nodes[last].count == 0)
+            last = binary.nodes[last].offset;
+        const auto& last_leaf = binary.nodes[last];
+        return { binary.nodes[first].offset, last_leaf.offset + last_leaf.count };
+    }
+
+    bool fits_sphere_block(const linear_bvh& binary, uint32_t index) const {
+        if (!use_sphere_blocks)
+            return false;
+
+        auto [first, end] = primitive_range(binary, index);
+        if (end - first < 2 || end - first > uint32_t(sphere_block_size))
+            return false;
+
+        for (auto i = first; i < end; i++) {
+            if (!dynamic_cast<const sphere*>(primitives[i].get()))
+                return false;
+        }
+        return true;
+    }
+};
+
+
 #endif
@@ -0,0 +1,196 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Measures single-threaded traversal throughput of the acceleration structures on the
+// bouncing spheres scene from TheNextWeek, on a variant of it with 100k spheres, and on the
+// scenes shipped here (Cornell box, snowman, and the test.cc showcase without its fog, whose
+// random hits would make runs incomparable). Every accelerator traces the same primary rays
+// and the same diffuse secondary rays, and must report the same hits. The 4-wide BVH runs
+// with and without its sphere blocks. The binary and 4-wide BVHs built with the SAH also
+// report how many nodes and primitives a ray visits on average. Each accelerator is also timed
+// answering occluded() for the same rays, which must agree with hit(). The plain list is left
+// out of the large scene, where it would take hours.
+
+#include "rtweekend.h"
+
+#include "bench_scenes.h"
+#include "bvh.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+std::vector<ray> make_rays(
+    const hittable& reference, const bench_scene& scene, int count
+) {
+    // Half of the rays leave the scene's camera through random points of its view; the
+    // other half bounce off the surfaces those primary rays hit.
+
+    std::vector<ray> rays;
+    rays.reserve(count);
+
+    const auto& cam = scene.cam;
+    auto w = unit_vector(cam.lookfrom - cam.lookat);
+    auto u = unit_vector(cross(vec3(0,1,0), w));
+    auto v = cross(w, u);
+    auto h = std::tan(degrees_to_radians(cam.vfov) / 2);
+
+    while (int(rays.size()) < count) {
+        auto sx = random_double(-1, 1) * h * cam.aspect_ratio;
+        auto sy = random_double(-1, 1) * h;
+        ray primary(cam.lookfrom, sx*u + sy*v - w, random_double());
+        rays.push_back(primary);
+
+        hit_record rec;
+        if (reference.hit(primary, interval(0, infinity), rec))
+            rays.push_back(rec.spawn_ray(rec.normal + random_unit_vector(), primary.time()));
+    }
+
+    rays.resize(count);
+    return rays;
+}
+
+
+struct candidate {
+    const char* name;
+    const hittable* accel;
+    long long hits = 0;
+    double t_sum = 0;
+    double best_seconds = infinity;
+    long long mismatches = 0;  // Rays where occluded() disagrees with hit()
+    double best_occluded_seconds = infinity;
+};
+
+
+void trace_all(candidate& c, const std::vector<ray>& rays) {
+    // Traces the rays for their closest hits, then asks whether each is occluded at all.
+
+    c.hits = 0;
+    c.t_sum = 0;
+    std::vector<bool> found(rays.size());
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < rays.size(); n++) {
+        hit_record rec;
+        if (c.accel->hit(rays[n], interval(0, infinity), rec)) {
+            c.hits++;
+            c.t_sum += rec.t;
+            found[n] = true;
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    auto seconds = std::chrono::duration<double>(stop - start).count();
+    c.best_seconds = std::fmin(c.best_seconds, seconds);
+
+    c.mismatches = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < rays.size(); n++) {
+        if (c.accel->occluded(rays[n], interval(0, infinity)) != found[n])
+            c.mismatches++;
+    }
+    stop = std::chrono::steady_clock::now();
+
+    seconds = std::chrono::duration<double>(stop - start).count();
+    c.best_occluded_seconds = std::fmin(c.best_occluded_seconds, seconds);
+}
+
+
+void run(std::vector<candidate>& candidates, const std::vector<ray>& rays, int trials) {
+    // Interleaves the candidates across trials and keeps each one's best time, which is far
+    // more stable than a mean on a busy machine.
+
+    for (int trial = 0; trial < trials; trial++)
+        for (auto& c : candidates)
+            trace_all(c, rays);
+
+    for (const auto& c : candidates) {
+        auto mrays = double(rays.size()) / c.best_seconds / 1e6;
+        auto occluded_mrays = double(rays.size()) / c.best_occluded_seconds / 1e6;
+        std::cout << std::left << std::setw(12) << c.name << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(9) << mrays << " Mrays/s   "
+                  << "occluded " << std::setw(9) << occluded_mrays << " Mrays/s   "
+                  << "hits " << c.hits << "   t checksum " << std::setprecision(6) << c.t_sum;
+        if (c.mismatches > 0)
+            std::cout << "   OCCLUSION MISMATCHES " << c.mismatches;
+        std::cout << '\n';
+    }
+}
+
+
+template <typename accelerator>
+void report_visits(const char* name, const accelerator& accel, const std::vector<ray>& rays) {
+    // Counts are deterministic, so one pass is enough.
+    traversal_counts counts;
+    for (const auto& r : rays) {
+        hit_record rec;
+        accel.hit_counted(r, interval(0, infinity), rec, counts);
+    }
+
+    auto per_ray = 1.0 / counts.rays;
+    std::cout << std::left << std::setw(12) << name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(9) << counts.nodes * per_ray
+              << " nodes/ray   " << counts.primitives * per_ray << " primitives/ray\n";
+}
+
+
+void bench(const bench_scene& scene) {
+    std::cout << std::defaultfloat << "== " << scene.name
+              << " (" << scene.world.objects.size() << " objects)\n";
+
+    bvh_build_options median_options;
+    median_options.split = bvh_split::object_median;
+
+    bvh_node tree(scene.world);
+    linear_bvh median(scene.world, median_options);
+    linear_bvh sah(scene.world);
+    wide_bvh wide(scene.world);
+
+    bvh_build_options no_blocks;
+    no_blocks.sphere_blocks = false;
+    wide_bvh wide_no_blocks(scene.world, no_blocks);
+
+    std::cout << "median: " << median.stats() << '\n'
+              << "sah:    " << sah.stats() << '\n'
+              << "bvh4:   " << wide.node_count() << " nodes, " << wide.sphere_block_count()
+              << " sphere blocks, built in " << wide.build_time() << " s\n";
+
+    auto rays = make_rays(tree, scene, 200000);
+
+    std::vector<candidate> candidates = {
+        { "list",       &scene.world },
+        { "bvh_node",   &tree },
+        { "median",     &median },
+        { "sah",        &sah },
+        { "bvh4 plain", &wide_no_blocks },
+        { "bvh4",       &wide },
+    };
+    if (scene.world.objects.size() > 10000)
+        candidates.erase(candidates.begin());
+
+    run(candidates, rays, 7);
+    report_visits("sah", sah, rays);
+    report_visits("bvh4 plain", wide_no_blocks, rays);
+    report_visits("bvh4", wide, rays);
+    std::cout << '\n';
+}
+
+
+int main() {
+    auto large = bouncing_spheres(158);
+    large.name = "bouncing spheres 100k";
+
+    bench(bouncing_spheres());
+    bench(large);
+    bench(cornell_box());
+    bench(snowman());
+    bench(showcase(false));
+}
@@ -0,0 +1,83 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Times BVH construction for a procedurally generated scene of a million small spheres, once
+// for the recursive bvh_node and then for linear_bvh on thread pools of increasing size. Each
+// tree then traces the same rays, and all of them must report the same hits.
+//
+// Usage: bvh_build_bench [sphere count]
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+hittable_list sphere_cloud(int count) {
+    // Spheres of varying size scattered uniformly through a cube.
+
+    hittable_list world;
+    world.objects.reserve(count);
+
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    for (int i = 0; i < count; i++) {
+        auto center = point3(random_double(-100,100), random_double(-100,100),
+                             random_double(-100,100));
+        world.add(make_shared<sphere>(center, random_double(0.05, 0.3), white));
+    }
+
+    return world;
+}
+
+
+int main(int argc, char* argv[]) {
+    int count = (argc > 1) ? std::atoi(argv[1]) : 1000000;
+    auto world = sphere_cloud(count);
+    std::cout << count << " spheres\n";
+
+    std::vector<ray> rays;
+    for (int i = 0; i < 20000; i++) {
+        auto direction = vec3(random_double(-0.4,0.4), random_double(-0.4,0.4), 1);
+        rays.push_back(ray(point3(0,0,-300), direction));
+    }
+
+    auto count_hits = [&](const hittable& tree) {
+        long long hits = 0;
+        for (const auto& r : rays) {
+            hit_record rec;
+            hits += tree.hit(r, interval(0, infinity), rec);
+        }
+        return hits;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    bvh_node tree(world);
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "bvh_node:          built in " << seconds << " s, " << count_hits(tree)
+              << " hits\n";
+
+    int max_threads = std::max(1, int(std::thread::hardware_concurrency()));
+    for (int threads = 1; ; threads = std::min(2 * threads, max_threads)) {
+        thread_pool pool(threads);
+        linear_bvh accel(world, {}, &pool);
+        std::cout << "linear_bvh, " << threads << " thr: " << accel.stats() << ", "
+                  << count_hits(accel) << " hits\n";
+        if (threads == max_threads)
+            break;
+    }
+}
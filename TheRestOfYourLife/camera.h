@@ -12,14 +12,117 @@
 //==============================================================================================
 
 #include "hittable.h"
+#include "image_output.h"
 #include "pdf.h"
 #include "material.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
 #include <thread>
+#include <typeinfo>
 #include <vector>
 #include <iostream>
 #include <fstream>
 
+enum class path_integrator {
+    recursive,  // One ray_color call per bounce, summing radiance on the way back up
+    iterative,  // A single loop over bounces that carries the path state forward
+    next_event, // The loop, plus a light sample per bounce, combined with MIS
+    wavefront   // The next event estimator, run one stage at a time over batches of paths
+};
+
+
+struct path_statistics {
+    // How the paths traced by the iterative integrators ended, and after how many bounces.
+
+    long long paths           = 0;
+    long long rays            = 0;  // Rays traced, counting escaped and light sample rays
+    long long escaped         = 0;  // Left the scene, picking up the background
+    long long absorbed        = 0;  // Hit a surface that doesn't scatter (an emitter)
+    long long depth_limit     = 0;  // Reached max_depth
+    long long zero_throughput = 0;  // Could no longer carry any light
+    long long roulette        = 0;  // Ended by Russian roulette
+    std::vector<long long> lengths;  // Number of paths ending after each bounce count
+
+    void record_end(int bounces, long long& reason) {
+        paths++;
+        reason++;
+        if (int(lengths.size()) <= bounces)
+            lengths.resize(bounces + 1, 0);
+        lengths[bounces]++;
+    }
+
+    void merge(const path_statistics& other) {
+        paths += other.paths;
+        rays += other.rays;
+        escaped += other.escaped;
+        absorbed += other.absorbed;
+        depth_limit += other.depth_limit;
+        zero_throughput += other.zero_throughput;
+        roulette += other.roulette;
+        if (lengths.size() < other.lengths.size())
+            lengths.resize(other.lengths.size(), 0);
+        for (size_t i = 0; i < other.lengths.size(); i++)
+            lengths[i] += other.lengths[i];
+    }
+
+    double mean_length() const {
+        long long bounces = 0;
+        for (size_t i = 0; i < lengths.size(); i++)
+            bounces += lengths[i] * (long long)i;
+        return paths ? double(bounces) / paths : 0.0;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const path_statistics& stats) {
+    auto rays_per_path = stats.paths ? double(stats.rays) / stats.paths : 0.0;
+    return out << stats.paths << " paths, " << rays_per_path << " rays/path, mean length "
+               << stats.mean_length() << " (ended: " << stats.escaped << " escaped, "
+               << stats.absorbed << " absorbed, " << stats.depth_limit << " at max depth, "
+               << stats.zero_throughput << " zero throughput, " << stats.roulette
+               << " roulette)";
+}
+
+
+struct pixel_accumulator {
+    // Running totals for the samples of one pixel. The mean and variance of the sample
+    // luminance are updated with Welford's method, which stays accurate over many samples.
+
+    color  sum   = color(0,0,0);
+    int    count = 0;
+    double mean  = 0;  // Mean luminance
+    double m2    = 0;  // Sum of squared luminance deviations from the mean
+
+    void add(const color& sample) {
+        sum += sample;
+        count++;
+
+        auto luminance = 0.2126 * sample.x() + 0.7152 * sample.y() + 0.0722 * sample.z();
+        auto delta = luminance - mean;
+        mean += delta / count;
+        m2 += delta * (luminance - mean);
+    }
+
+    color average() const { return count > 0 ? sum / count : color(0,0,0); }
+
+    double relative_error() const {
+        // Standard error of the mean luminance, relative to the mean. The small floor keeps
+        // nearly black pixels from needing an unreachable absolute precision.
+        if (count < 2)
+            return infinity;
+        auto standard_error = std::sqrt(m2 / (double(count - 1) * count));
+        return standard_error / (std::fabs(mean) + 1e-3);
+    }
+};
+
+
 class camera {
   public:
     double aspect_ratio      = 1.0;  // Ratio of image width over height
@@ -36,63 +139,144 @@ class camera {
     double defocus_angle = 0;  // Variation angle of rays through each pixel
     double focus_dist = 10;    // Distance from camera lookfrom point to plane of perfect focus
 
-    void render(const hittable& world, const hittable& lights, const std::string& filename) {
-    initialize();
+    int      tile_size    = 16;  // Edge length in pixels of the square tiles handed to threads
+    int      thread_count = 0;   // Threads of the camera's own pool (0 for one per core)
+    uint64_t seed         = 0;   // Seed for the per-sample random sequences
 
-    std::ofstream output_file(filename);
-    if (!output_file.is_open()) {
-        std::cerr << "Erro: Não foi possível abrir o arquivo de saída." << std::endl;
-        return;
-    }
+    path_integrator integrator = path_integrator::recursive;   // How each sample is traced
+    sampler_type    sampler    = sampler_type::random;          // Source of the sample numbers
+    bool            ray_packets = false;  // Trace each pixel's camera rays in packets (not
+                                          // for the recursive integrator)
 
-    output_file << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+    bool   russian_roulette      = false;  // Randomly end low-throughput paths (not recursive)
+    int    roulette_depth        = 3;      // Bounces before roulette starts
+    double roulette_min_survival = 0.5;    // Lower bound on the survival probability
 
-    const int num_threads = std::thread::hardware_concurrency();
-    std::vector<std::thread> threads;
-    std::vector<color> pixel_buffer(image_width * image_height);
+    // Adaptive sampling spends the same total of samples_per_pixel per pixel on average, but
+    // stops sampling pixels whose relative error reaches the target.
+    bool        adaptive_sampling    = false;
+    double      adaptive_target      = 0.02;  // Relative standard error of a converged pixel
+    int         adaptive_min_samples = 16;    // Samples every pixel gets before any estimate
+    std::string sample_map_file;              // If set, the per-pixel sample counts (PGM)
 
-    auto render_slice = [&](int start_j, int end_j) {
-        for (int j = start_j; j < end_j; ++j) {
-            for (int i = 0; i < image_width; ++i) {
-                color pixel_color(0, 0, 0);
-                for (int s_j = 0; s_j < sqrt_spp; s_j++) {
-                    for (int s_i = 0; s_i < sqrt_spp; s_i++) {
-                        ray r = get_ray(i, j, s_i, s_j);
-                        pixel_color += ray_color(r, max_depth, world, lights);
-                    }
-                }
-                pixel_buffer[j * image_width + i] = pixel_samples_scale * pixel_color;
+    // Progressive rendering keeps adding passes of samples_per_pixel samples to every pixel
+    // until one of its limits is reached, and returns the image accumulated by then.
+    bool   progressive  = false;
+    double time_budget  = 0;  // Wall-clock seconds for the whole render (0 for no limit)
+    double noise_target = 0;  // RMS relative error of the pixels to stop at (0 for none)
+    int    max_passes   = 0;  // Passes to stop after (0 for no limit)
+    std::atomic<bool>* cancel_flag = nullptr;  // Raised from another thread to stop early
+
+    // Progressive renders can save their state to a checkpoint file and later resume from it.
+    std::string checkpoint_file;            // Where to save the state (empty for never)
+    double      checkpoint_interval = 300;  // Seconds between saves, besides the final one
+    bool        resume              = false;  // Start from checkpoint_file if it matches
+
+    void render(const hittable& world, const hittable& lights, const std::string& filename) {
+        thread_pool pool(thread_count);
+        render(pool, world, lights, filename);
+    }
+
+    void render(
+        thread_pool& pool, const hittable& world, const hittable& lights,
+        const std::string& filename
+    ) {
+        // Renders the image on the given pool and writes it to the named file, in the format
+        // that the file extension selects (see image_format_for). Binary PPM files are mapped
+        // into memory and filled by the render threads as they finish their tiles.
+
+        if (image_format_for(filename) == image_format::ppm_binary) {
+            initialize();
+            mapped_ppm image(filename, image_width, image_height);
+            if (image.is_open()) {
+                render_pixels(pool, world, lights,
+                    [&](int i0, int j0, int i1, int j1, const std::vector<color>& pixels) {
+                        image.write_pixels(pixels, i0, j0, i1, j1);
+                    });
+                log_line(std::clog, "Done.\n");
+                return;
             }
         }
-    };
 
-    int slice_height = image_height / num_threads;
-    for (int t = 0; t < num_threads; ++t) {
-        int start_j = t * slice_height;
-        int end_j = (t == num_threads - 1) ? image_height : start_j + slice_height;
-        threads.emplace_back(render_slice, start_j, end_j);
+        auto pixel_buffer = render_pixels(pool, world, lights);
+        if (write_image(filename, pixel_buffer, image_width, image_height))
+            log_line(std::clog, "Done.\n");
     }
 
-    for (auto& thread : threads) {
-        thread.join();
+    using finished_pixels = std::function<void(
+        int start_i, int start_j, int end_i, int end_j, const std::vector<color>& pixels)>;
+
+    std::vector<color> render_pixels(
+        const hittable& world, const hittable& lights, const finished_pixels& on_finished = {}
+    ) {
+        thread_pool pool(thread_count);
+        return render_pixels(pool, world, lights, on_finished);
     }
 
-    // Escrever o buffer no arquivo de saída
-    for (int j = 0; j < image_height; ++j) {
-        std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i) {
-            write_color(output_file, pixel_buffer[j * image_width + i]);
+    std::vector<color> render_pixels(
+        thread_pool& pool, const hittable& world, const hittable& lights,
+        const finished_pixels& on_finished = {}
+    ) {
+        // Renders the image on the given pool into a row-major buffer of linear pixel colors.
+        // If given, on_finished is called from the render threads with each rectangle of the
+        // buffer whose final colors are known, as soon as they are.
+
+        initialize();
+        statistics = path_statistics();
+
+        auto start_time = std::chrono::steady_clock::now();
+
+        std::vector<color> pixel_buffer(image_width * image_height);
+
+        if (!checkpoint_file.empty() && !progressive) {
+            log_line(std::cerr, "Checkpoints are only saved by progressive renders, so ",
+                     checkpoint_file, " won't be written; set progressive to save one\n");
         }
+
+        if (progressive) {
+            pixel_buffer = render_progressive(pool, world, lights);
+        } else if (adaptive_sampling) {
+            pixel_buffer = render_adaptive(pool, world, lights);
+        } else {
+            for_each_tile(pool, [&](int i0, int j0, int i1, int j1, path_statistics& stats) {
+                render_tile(world, lights, i0, j0, i1, j1, pixel_buffer, stats);
+                if (on_finished)
+                    on_finished(i0, j0, i1, j1, pixel_buffer);
+            });
+        }
+
+        if (on_finished && (progressive || adaptive_sampling)) {
+            // These modes only know the final colors once every pass is done.
+            auto band = size_t(std::max(1, tile_size));
+            pool.parallel_for(size_t(image_height), band, [&](size_t j0, size_t j1) {
+                on_finished(0, int(j0), image_width, int(j1), pixel_buffer);
+            });
+        }
+
+        auto stop_time = std::chrono::steady_clock::now();
+        auto render_seconds = std::chrono::duration<double>(stop_time - start_time).count();
+        log_line(std::clog, "Rendered in ", render_seconds, " s\n");
+        if (statistics.paths > 0)
+            log_line(std::clog, statistics, '\n');
+
+        return pixel_buffer;
     }
 
-    std::clog << "\rDone.          \n";
-}
+    const path_statistics& last_statistics() const {
+        // Returns the path statistics of the most recent render.
+        return statistics;
+    }
+
+    const std::vector<int>& last_sample_counts() const {
+        // Returns the samples taken per pixel by the most recent adaptive or progressive
+        // render.
+        return sample_counts;
+    }
 
   private:
     int    image_height;         // Rendered image height
     double pixel_samples_scale;  // Color scale factor for a sum of pixel samples
     int    sqrt_spp;             // Square root of number of samples per pixel
-    double recip_sqrt_spp;       // 1 / sqrt_spp
     point3 center;               // Camera center
     point3 pixel00_loc;          // Location of pixel 0, 0
     vec3   pixel_delta_u;        // Offset to pixel to the right
@@ -100,14 +284,21 @@ class camera {
     vec3   u, v, w;              // Camera frame basis vectors
     vec3   defocus_disk_u;       // Defocus disk horizontal radius
     vec3   defocus_disk_v;       // Defocus disk vertical radius
+    path_statistics statistics;  // Gathered by the iterative integrators during a render
+    std::vector<int> sample_counts;  // Per pixel, from the last adaptive or progressive render
+
+    // The last two characters are the version of the checkpoint format. Version 02 added the
+    // sampler, roulette and adaptive settings and the geometry precision to the settings, and
+    // version 03 the view and the background.
+    static constexpr char checkpoint_magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '0', '3'};
+    static constexpr size_t checkpoint_version_size = 2;
 
     void initialize() {
         image_height = int(image_width / aspect_ratio);
         image_height = (image_height < 1) ? 1 : image_height;
 
         sqrt_spp = int(std::sqrt(samples_per_pixel));
-        pixel_samples_scale = 1.0 / (sqrt_spp * sqrt_spp);
-        recip_sqrt_spp = 1.0 / sqrt_spp;
+        pixel_samples_scale = 1.0 / std::max(1, samples_per_pixel);
 
         center = lookfrom;
 
@@ -140,11 +331,531 @@ class camera {
         defocus_disk_v = v * defocus_radius;
     }
 
-    ray get_ray(int i, int j, int s_i, int s_j) const {
-        // Construct a camera ray originating from the defocus disk and directed at a randomly
-        // sampled point around the pixel location i, j for stratified sample square s_i, s_j.
+    using tile_function =
+        std::function<void(int start_i, int start_j, int end_i, int end_j, path_statistics&)>;
+
+    void for_each_tile(thread_pool& pool, const tile_function& render) {
+        // Splits the image into small tiles and lets the pool balance them across threads, so
+        // the expensive regions of the image don't all land on a single thread.
+
+        task_group tiles;
+        std::mutex statistics_mutex;
+
+        int tile = std::max(1, tile_size);
+        for (int tile_j = 0; tile_j < image_height; tile_j += tile) {
+            for (int tile_i = 0; tile_i < image_width; tile_i += tile) {
+                int end_i = std::min(tile_i + tile, image_width);
+                int end_j = std::min(tile_j + tile, image_height);
+                pool.run(tiles, [&, tile_i, tile_j, end_i, end_j] {
+                    path_statistics tile_statistics;
+                    render(tile_i, tile_j, end_i, end_j, tile_statistics);
+
+                    std::lock_guard<std::mutex> lock(statistics_mutex);
+                    statistics.merge(tile_statistics);
+                });
+            }
+        }
+
+        pool.wait(tiles);
+    }
+
+    std::vector<color> render_adaptive(
+        thread_pool& pool, const hittable& world, const hittable& lights
+    ) {
+        // Every pixel first gets adaptive_min_samples samples. After that, each pass gives
+        // another batch to the pixels that are still above the target error, noisiest first,
+        // until the budget of samples_per_pixel per pixel is spent or every pixel converged.
+        // No pixel takes more than max_factor times its share, so a few fireflies can't
+        // swallow the whole budget.
+
+        constexpr int max_factor = 8;
+
+        auto pixel_count = size_t(image_width) * size_t(image_height);
+        auto budget = (long long)pixel_count * samples_per_pixel;
+        auto max_samples = max_factor * samples_per_pixel;
+        auto batch_size = std::max(1, std::min(adaptive_min_samples, samples_per_pixel));
+        long long spent = 0;
+
+        std::vector<pixel_accumulator> pixels(pixel_count);
+        std::vector<int> batch(pixel_count, batch_size);
+
+        while (true) {
+            for_each_tile(pool, [&](int i0, int j0, int i1, int j1, path_statistics& st) {
+                sample_tile(world, lights, i0, j0, i1, j1, pixels, batch, st);
+            });
+
+            for (auto n : batch)
+                spent += n;
+
+            // Rank the unconverged pixels by their error and hand out the next pass.
+            auto errors = block_errors(pixels);
+            std::vector<std::pair<double, size_t>> noisy;
+            for (size_t k = 0; k < pixel_count; k++) {
+                auto error = errors[k];
+                if (error > adaptive_target && pixels[k].count < max_samples)
+                    noisy.push_back({error, k});
+            }
+
+            auto remaining = budget - spent;
+            auto affordable = size_t(std::max(0LL, remaining / batch_size));
+            if (noisy.empty() || affordable == 0)
+                break;
+
+            if (noisy.size() > affordable) {
+                std::nth_element(
+                    noisy.begin(), noisy.begin() + affordable, noisy.end(),
+                    [](const auto& a, const auto& b) { return a.first > b.first; });
+                noisy.resize(affordable);
+            }
+
+            std::fill(batch.begin(), batch.end(), 0);
+            for (const auto& [error, k] : noisy)
+                batch[k] = std::min(batch_size, max_samples - pixels[k].count);
+        }
+
+        sample_counts.resize(pixel_count);
+        std::vector<color> pixel_buffer(pixel_count);
+        int fewest = max_samples, most = 0;
+        for (size_t k = 0; k < pixel_count; k++) {
+            sample_counts[k] = pixels[k].count;
+            pixel_buffer[k] = pixels[k].average();
+            fewest = std::min(fewest, pixels[k].count);
+            most = std::max(most, pixels[k].count);
+        }
+
+        log_line(std::clog, "Adaptive sampling: ", double(spent) / pixel_count,
+                 " samples/pixel on average, ", fewest, " to ", most, '\n');
+
+        if (!sample_map_file.empty())
+            write_sample_map(sample_map_file, most);
+
+        return pixel_buffer;
+    }
+
+    std::vector<color> render_progressive(
+        thread_pool& pool, const hittable& world, const hittable& lights
+    ) {
+        // Adds passes of samples to every pixel until the time budget, the noise target or
+        // max_passes is reached, or cancel_flag is raised. A pass isn't started when the
+        // slowest pass so far wouldn't fit in the remaining time. A pass that overruns the
+        // deadline anyway, or is cancelled, skips its remaining tiles; the pixels it reached
+        // keep their extra samples.
+        //
+        // With a checkpoint_file, the state after the last complete pass is saved every
+        // checkpoint_interval seconds and when the render stops. Since the random numbers of
+        // every sample depend only on the seed, the pixel and the sample's index, a resumed
+        // render continues exactly where the saved one left off.
+
+        using clock = std::chrono::steady_clock;
+
+        auto start = clock::now();
+        auto deadline = start + std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(time_budget));
+        auto out_of_time = [&] { return time_budget > 0 && clock::now() >= deadline; };
+
+        auto pixel_count = size_t(image_width) * size_t(image_height);
+        std::vector<pixel_accumulator> pixels(pixel_count);
+        std::vector<int> batch(pixel_count, std::max(1, samples_per_pixel));
+
+        bool checkpointing = !checkpoint_file.empty();
+        uint64_t pass = 0;
+        if (checkpointing && resume)
+            pass = load_checkpoint(pixels);
+
+        std::vector<pixel_accumulator> pass_start_pixels;  // For checkpoints of cut passes
+        auto last_checkpoint = clock::now();
+        double slowest_pass = 0;
+        bool interrupted = false;
+        const char* stop_reason = "pass limit";
+
+        while (true) {
+            if (cancelled()) {
+                stop_reason = "cancelled";
+                break;
+            }
+            if (max_passes > 0 && pass >= uint64_t(max_passes)) {
+                stop_reason = "pass limit";
+                break;
+            }
+            auto elapsed = std::chrono::duration<double>(clock::now() - start).count();
+            if (time_budget > 0 && elapsed + slowest_pass > time_budget) {
+                stop_reason = "time budget";
+                break;
+            }
+
+            if (checkpointing)
+                pass_start_pixels = pixels;
+
+            std::atomic<bool> cut_short{false};
+            auto pass_start = clock::now();
+            for_each_tile(pool, [&](int i0, int j0, int i1, int j1, path_statistics& st) {
+                if (cancelled() || out_of_time()) {
+                    cut_short = true;
+                    return;
+                }
+                sample_tile(world, lights, i0, j0, i1, j1, pixels, batch, st);
+            });
+
+            if (cut_short) {
+                interrupted = true;
+                stop_reason = cancelled() ? "cancelled" : "time budget";
+                break;
+            }
+
+            auto pass_time = std::chrono::duration<double>(clock::now() - pass_start);
+            slowest_pass = std::fmax(slowest_pass, pass_time.count());
+            pass++;
+
+            if (noise_target > 0 && image_error(pixels) <= noise_target) {
+                stop_reason = "noise target";
+                break;
+            }
+
+            auto since_save = std::chrono::duration<double>(clock::now() - last_checkpoint);
+            if (checkpointing && since_save.count() >= checkpoint_interval) {
+                save_checkpoint(pass, pixels);
+                last_checkpoint = clock::now();
+            }
+        }
+
+        if (checkpointing)
+            save_checkpoint(pass, interrupted ? pass_start_pixels : pixels);
+
+        sample_counts.resize(pixel_count);
+        std::vector<color> pixel_buffer(pixel_count);
+        long long samples = 0;
+        for (size_t k = 0; k < pixel_count; k++) {
+            sample_counts[k] = pixels[k].count;
+            pixel_buffer[k] = pixels[k].average();
+            samples += pixels[k].count;
+        }
+
+        log_line(std::clog, "Progressive: ", pass, " passes, ", double(samples) / pixel_count,
+                 " samples/pixel, error ", image_error(pixels), ", stopped by ", stop_reason,
+                 '\n');
+
+        return pixel_buffer;
+    }
+
+    std::array<uint64_t, 28> checkpoint_settings() const {
+        // The settings a checkpoint must have been saved with to be resumed by this camera:
+        // the view, the background, and every setting that changes the samples a pixel draws
+        // or how they're turned into its estimate, so that a resumed render matches one that
+        // was never interrupted. Doubles are compared by their bits. ray_packets, tile_size and
+        // the thread count are left out, as they don't change the result.
+        return {
+            uint64_t(image_width), uint64_t(image_height), uint64_t(samples_per_pixel),
+            uint64_t(max_depth), uint64_t(integrator), seed, uint64_t(sampler),
+            uint64_t(russian_roulette), uint64_t(roulette_depth), bits(roulette_min_survival),
+            uint64_t(adaptive_sampling), bits(adaptive_target), uint64_t(adaptive_min_samples),
+            bits(lookfrom.x()), bits(lookfrom.y()), bits(lookfrom.z()),
+            bits(lookat.x()), bits(lookat.y()), bits(lookat.z()),
+            bits(vup.x()), bits(vup.y()), bits(vup.z()),
+            bits(vfov), bits(defocus_angle), bits(focus_dist),
+            bits(background.x()), bits(background.y()), bits(background.z())
+        };
+    }
+
+    static uint64_t bits(double value) {
+        uint64_t result;
+        std::memcpy(&result, &value, sizeof result);
+        return result;
+    }
+
+    template <typename T>
+    static void write_binary(std::ostream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof value);
+    }
+
+    template <typename T>
+    static void read_binary(std::istream& in, T& value) {
+        in.read(reinterpret_cast<char*>(&value), sizeof value);
+    }
+
+    void save_checkpoint(uint64_t passes, const std::vector<pixel_accumulator>& pixels) const {
+        // Writes the settings, the size of `real`, the completed pass count and every pixel
+        // accumulator in native byte order. The state goes to a temporary file first and is
+        // then renamed over the checkpoint, so a crash while saving leaves the previous
+        // checkpoint intact.
+
+        auto temporary = checkpoint_file + ".tmp";
+        std::ofstream out(temporary, std::ios::binary);
+
+        out.write(checkpoint_magic, sizeof checkpoint_magic);
+        for (auto setting : checkpoint_settings())
+            write_binary(out, setting);
+        write_binary(out, uint64_t(sizeof(real)));
+        write_binary(out, passes);
+
+        for (const auto& pixel : pixels) {
+            write_binary(out, double(pixel.sum.x()));
+            write_binary(out, double(pixel.sum.y()));
+            write_binary(out, double(pixel.sum.z()));
+            write_binary(out, int64_t(pixel.count));
+            write_binary(out, pixel.mean);
+            write_binary(out, pixel.m2);
+        }
+
+        out.close();
+        if (!out || std::rename(temporary.c_str(), checkpoint_file.c_str()) != 0)
+            log_line(std::cerr, "Could not save the checkpoint ", checkpoint_file, '\n');
+    }
+
+    uint64_t load_checkpoint(std::vector<pixel_accumulator>& pixels) const {
+        // Restores the pixels from checkpoint_file and returns the passes it had completed,
+        // or returns 0 and leaves the pixels alone if there's no checkpoint for this render.
+
+        std::ifstream in(checkpoint_file, std::ios::binary);
+        if (!in.is_open())
+            return 0;
+
+        char magic[sizeof checkpoint_magic];
+        in.read(magic, sizeof magic);
+        auto format_end = checkpoint_magic + sizeof checkpoint_magic - checkpoint_version_size;
+        if (in && std::equal(checkpoint_magic, format_end, magic)
+               && !std::equal(magic, magic + sizeof magic, checkpoint_magic)) {
+            log_line(std::cerr, "Checkpoint ", checkpoint_file,
+                     " is from an older version of the format, starting over\n");
+            return 0;
+        }
+        bool matches = in && std::equal(magic, magic + sizeof magic, checkpoint_magic);
+
+        for (auto setting : checkpoint_settings()) {
+            uint64_t saved = 0;
+            read_binary(in, saved);
+            matches = matches && in && saved == setting;
+        }
+
+        // The sums are saved as doubles either way, but were accumulated in the precision of
+        // the geometry, so a render resumes only in the precision it was saved in.
+        uint64_t saved_precision = 0;
+        read_binary(in, saved_precision);
+        matches = matches && in && saved_precision == sizeof(real);
+
+        if (!matches) {
+            log_line(std::cerr, "Checkpoint ", checkpoint_file,
+                     " is from a different render, starting over\n");
+            return 0;
+        }
+
+        uint64_t passes = 0;
+        read_binary(in, passes);
+
+        std::vector<pixel_accumulator> restored(pixels.size());
+        for (auto& pixel : restored) {
+            double r, g, b;
+            int64_t count;
+            read_binary(in, r);
+            read_binary(in, g);
+            read_binary(in, b);
+            read_binary(in, count);
+            read_binary(in, pixel.mean);
+            read_binary(in, pixel.m2);
+            pixel.sum = color(r, g, b);
+            pixel.count = int(count);
+        }
+
+        if (!in) {
+            log_line(std::cerr, "Checkpoint ", checkpoint_file,
+                     " is truncated, starting over\n");
+            return 0;
+        }
+
+        log_line(std::clog, "Resuming after ", passes, " passes\n");
+        pixels = std::move(restored);
+        return passes;
+    }
+
+    bool cancelled() const {
+        return cancel_flag && cancel_flag->load(std::memory_order_relaxed);
+    }
+
+    static double image_error(const std::vector<pixel_accumulator>& pixels) {
+        // Returns the RMS relative error over the pixels that have an error estimate.
+
+        double sum = 0;
+        size_t n = 0;
+        for (const auto& pixel : pixels) {
+            auto error = pixel.relative_error();
+            if (std::isfinite(error)) {
+                sum += error * error;
+                n++;
+            }
+        }
+        return n > 0 ? std::sqrt(sum / n) : infinity;
+    }
+
+    std::vector<double> block_errors(const std::vector<pixel_accumulator>& pixels) const {
+        // Every pixel gets the RMS relative error of its block of pixels. A single pixel's
+        // estimate is too noisy to stop on: pixels whose first samples happen to agree would
+        // stop early and keep that luck, which darkens the image on average.
+
+        constexpr int block = 4;
+
+        std::vector<double> errors(pixels.size());
+        for (int block_j = 0; block_j < image_height; block_j += block) {
+            for (int block_i = 0; block_i < image_width; block_i += block) {
+                int end_i = std::min(block_i + block, image_width);
+                int end_j = std::min(block_j + block, image_height);
+
+                double sum = 0;
+                int n = 0;
+                for (int j = block_j; j < end_j; j++) {
+                    for (int i = block_i; i < end_i; i++) {
+                        auto error = pixels[size_t(j) * image_width + i].relative_error();
+                        if (std::isfinite(error)) {
+                            sum += error * error;
+                            n++;
+                        }
+                    }
+                }
+
+                auto block_error = n > 0 ? std::sqrt(sum / n) : infinity;
+                for (int j = block_j; j < end_j; j++)
+                    for (int i = block_i; i < end_i; i++)
+                        errors[size_t(j) * image_width + i] = block_error;
+            }
+        }
+
+        return errors;
+    }
+
+    void write_sample_map(const std::string& filename, int most) const {
+        // Writes the sample counts as a plain grayscale PGM whose gray level is the count.
+
+        std::ofstream out(filename);
+        if (!out.is_open()) {
+            log_line(std::cerr, "Could not open the sample map file ", filename, '\n');
+            return;
+        }
+
+        out << "P2\n" << image_width << ' ' << image_height << '\n';
+        out << std::max(1, most) << '\n';
+        for (int j = 0; j < image_height; j++) {
+            for (int i = 0; i < image_width; i++)
+                out << sample_counts[j * image_width + i] << (i + 1 < image_width ? ' ' : '\n');
+        }
+    }
+
+    void sample_tile(
+        const hittable& world, const hittable& lights, int start_i, int start_j, int end_i,
+        int end_j, std::vector<pixel_accumulator>& pixels, const std::vector<int>& batch,
+        path_statistics& stats
+    ) const {
+        // Adds batch[k] samples to every pixel k of the tile. Each sample's index is the
+        // pixel's count of samples before it.
+
+        if (integrator == path_integrator::wavefront) {
+            std::vector<camera_sample> samples;
+            for (int j = start_j; j < end_j; ++j) {
+                for (int i = start_i; i < end_i; ++i) {
+                    auto k = size_t(j) * image_width + i;
+                    int grid = int(std::sqrt(batch[k]));
+                    for (int s = 0; s < batch[k]; s++)
+                        samples.push_back({i, j, uint64_t(pixels[k].count + s), s, grid});
+                }
+            }
+
+            auto radiance = trace_wavefront(samples, world, lights, stats);
+            for (size_t n = 0; n < samples.size(); n++)
+                pixels[size_t(samples[n].j) * image_width + samples[n].i].add(radiance[n]);
+            return;
+        }
+
+        for (int j = start_j; j < end_j; ++j) {
+            for (int i = start_i; i < end_i; ++i) {
+                auto k = size_t(j) * image_width + i;
+                int grid = int(std::sqrt(batch[k]));
+                trace_pixel(i, j, uint64_t(pixels[k].count), batch[k], grid, world, lights,
+                            stats, [&](const color& sample) { pixels[k].add(sample); });
+            }
+        }
+    }
+
+    void render_tile(
+        const hittable& world, const hittable& lights, int start_i, int start_j, int end_i,
+        int end_j, std::vector<color>& pixel_buffer, path_statistics& stats
+    ) const {
+        if (integrator == path_integrator::wavefront) {
+            std::vector<camera_sample> samples;
+            for (int j = start_j; j < end_j; ++j)
+                for (int i = start_i; i < end_i; ++i)
+                    for (int s = 0; s < samples_per_pixel; s++)
+                        samples.push_back({i, j, uint64_t(s), s, sqrt_spp});
+
+            auto radiance = trace_wavefront(samples, world, lights, stats);
+            size_t n = 0;
+            for (int j = start_j; j < end_j; ++j) {
+                for (int i = start_i; i < end_i; ++i) {
+                    color pixel_color(0, 0, 0);
+                    for (int s = 0; s < samples_per_pixel; s++)
+                        pixel_color += radiance[n++];
+                    auto k = size_t(j) * image_width + i;
+                    pixel_buffer[k] = pixel_samples_scale * pixel_color;
+                }
+            }
+            return;
+        }
+
+        for (int j = start_j; j < end_j; ++j) {
+            for (int i = start_i; i < end_i; ++i) {
+                color pixel_color(0, 0, 0);
+                trace_pixel(i, j, 0, samples_per_pixel, sqrt_spp, world, lights, stats,
+                            [&](const color& sample) { pixel_color += sample; });
+                pixel_buffer[size_t(j) * image_width + i] = pixel_samples_scale * pixel_color;
+            }
+        }
+    }
+
+    template <typename Accumulate>
+    void trace_pixel(
+        int i, int j, uint64_t first_sample, int count, int grid, const hittable& world,
+        const hittable& lights, path_statistics& stats, Accumulate&& accumulate
+    ) const {
+        // Traces `count` samples of pixel i, j, numbered from first_sample, the n-th of them
+        // in stratum n of a grid x grid subdivision, and hands their colors to accumulate in
+        // order. With ray_packets, the camera rays go through the scene a packet at a time,
+        // and each path carries on alone from its first hit. The samples of one pixel are the
+        // most coherent rays there are, and packing them by pixel keeps the image independent
+        // of the tiling.
+
+        auto pixel = size_t(j) * image_width + i;
+        auto& sequence = thread_sampler();
+
+        if (!ray_packets || integrator == path_integrator::recursive) {
+            for (int s = 0; s < count; s++) {
+                sequence.start(sampler, seed, pixel, first_sample + s);
+                ray r = get_ray(i, j, pixel_offset(s, grid));
+                accumulate(sample_color(r, world, lights, stats));
+            }
+            return;
+        }
+
+        for (int first = 0; first < count; first += packet_size) {
+            ray_packet packet;
+            sample_sequence sequences[packet_size];
+            packet.sequences = sequences;
+
+            for (int s = first; s < std::min(count, first + packet_size); s++) {
+                sequence.start(sampler, seed, pixel, first_sample + s);
+                packet.add(get_ray(i, j, pixel_offset(s, grid)));
+                sequences[s - first] = sequence;
+            }
+
+            packet_hits hits(interval(0, infinity));
+            world.hit_packet(packet, packet.all_lanes(), hits);
+
+            for (int k = 0; k < packet.size(); k++) {
+                sequence = sequences[k];
+                accumulate(sample_color(packet.rays[k], world, lights, stats, &hits, k));
+            }
+        }
+    }
+
+    ray get_ray(int i, int j, const vec3& offset) const {
+        // Construct a camera ray originating from the defocus disk and directed at the point
+        // at the given offset from the pixel location i, j.
 
-        auto offset = sample_square_stratified(s_i, s_j);
         auto pixel_sample = pixel00_loc
                           + ((i + offset.x()) * pixel_delta_u)
                           + ((j + offset.y()) * pixel_delta_v);
@@ -156,12 +867,23 @@ class camera {
         return ray(ray_origin, ray_direction, ray_time);
     }
 
-    vec3 sample_square_stratified(int s_i, int s_j) const {
-        // Returns the vector to a random point in the square sub-pixel specified by grid
-        // indices s_i and s_j, for an idealized unit square pixel [-.5,-.5] to [+.5,+.5].
+    vec3 pixel_offset(int stratum, int grid) const {
+        // Returns the vector from the pixel center to the point of a pixel sample, for an
+        // idealized unit square pixel [-.5,-.5] to [+.5,+.5]. The low discrepancy samplers
+        // spread any count of samples over the pixel by themselves. Random samples are placed
+        // in sub-pixel `stratum` of a grid x grid subdivision, and past the last one,
+        // anywhere in the pixel.
+
+        if (sampler != sampler_type::random) {
+            auto [px, py] = thread_sampler().next_2d();
+            return vec3(px - 0.5, py - 0.5, 0);
+        }
 
-        auto px = ((s_i + random_double()) * recip_sqrt_spp) - 0.5;
-        auto py = ((s_j + random_double()) * recip_sqrt_spp) - 0.5;
+        if (stratum >= grid * grid)
+            return sample_square();
+
+        auto px = ((stratum % grid + random_double()) / grid) - 0.5;
+        auto py = ((stratum / grid + random_double()) / grid) - 0.5;
 
         return vec3(px, py, 0);
     }
@@ -177,9 +899,27 @@ class camera {
     }
 
     point3 defocus_disk_sample() const {
-        // Returns a random point in the camera defocus disk.
-        auto p = random_in_unit_disk();
-        return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
+        // Returns a random point in the camera defocus disk. The point is mapped from a pair
+        // of sample dimensions rather than found by rejection, so that it keeps the spread of
+        // the sampler's points.
+        auto [r1, r2] = thread_sampler().next_2d();
+        auto radius = std::sqrt(r1);
+        auto phi = 2 * pi * r2;
+        return center + (radius * std::cos(phi) * defocus_disk_u)
+                      + (radius * std::sin(phi) * defocus_disk_v);
+    }
+
+    color sample_color(
+        const ray& r, const hittable& world, const hittable& lights, path_statistics& stats,
+        const packet_hits* primary = nullptr, int lane = 0
+    ) const {
+        // The iterative integrators take the first hit of the ray from `primary`, if given,
+        // where the ray is number `lane` of a packet.
+        if (integrator == path_integrator::recursive)
+            return ray_color(r, max_depth, world, lights);
+        if (integrator == path_integrator::next_event)
+            return trace_path_mis(r, world, lights, stats, primary, lane);
+        return trace_path(r, world, lights, stats, primary, lane);
     }
 
     color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights)
@@ -191,7 +931,7 @@ class camera {
         hit_record rec;
 
         // If the ray hits nothing, return the background color.
-        if (!world.hit(r, interval(0.001, infinity), rec))
+        if (!world.hit(r, interval(0, infinity), rec))
             return background;
 
         scatter_record srec;
@@ -204,10 +944,10 @@ class camera {
             return srec.attenuation * ray_color(srec.skip_pdf_ray, depth-1, world, lights);
         }
 
-        auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-        mixture_pdf p(light_ptr, srec.pdf_ptr);
+        hittable_pdf light_pdf(lights, rec.p);
+        mixture_pdf p(light_pdf, *srec.pdf_ptr());
 
-        ray scattered = ray(rec.p, p.generate(), r.time());
+        ray scattered = rec.spawn_ray(p.generate(), r.time());
         auto pdf_value = p.value(scattered.direction());
 
         double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
@@ -218,6 +958,502 @@ class camera {
 
         return color_from_emission + color_from_scatter;
     }
+
+    struct path_state {
+        color throughput = color(1,1,1);  // Weight of light arriving along the current ray
+        color radiance   = color(0,0,0);  // Light gathered so far
+        int   bounces    = 0;             // Surfaces hit so far
+
+        // Used by the next event integrator to weight emission found by the scattered ray.
+        bool   specular     = true;  // The ray is a camera ray or left a skip_pdf material
+        point3 scatter_from;         // Where the ray was scattered from
+        double scatter_pdf  = 0;     // Density of the material pdf for the ray's direction
+    };
+
+    color trace_path(
+        const ray& primary, const hittable& world, const hittable& lights,
+        path_statistics& stats, const packet_hits* primary_hits = nullptr, int lane = 0
+    ) const {
+        // Follows the same estimator as ray_color, but walks the path forward in a loop. Each
+        // emission is added already scaled by the product of the attenuations before it,
+        // instead of being multiplied back through the stack, and a path whose throughput has
+        // dropped to zero ends early.
+
+        path_state path;
+        ray r = primary;
+
+        while (true) {
+            if (path.bounces >= max_depth) {
+                stats.record_end(path.bounces, stats.depth_limit);
+                break;
+            }
+
+            hit_record rec;
+            stats.rays++;
+
+            bool found = (primary_hits && path.bounces == 0)
+                       ? primary_hits->get(lane, rec)
+                       : world.hit(r, interval(0, infinity), rec);
+            if (!found) {
+                path.radiance += path.throughput * background;
+                stats.record_end(path.bounces, stats.escaped);
+                break;
+            }
+
+            path.bounces++;
+            path.radiance += path.throughput * rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+
+            scatter_record srec;
+            if (!rec.mat->scatter(r, rec, srec)) {
+                stats.record_end(path.bounces, stats.absorbed);
+                break;
+            }
+
+            if (srec.skip_pdf) {
+                path.throughput = path.throughput * srec.attenuation;
+                r = srec.skip_pdf_ray;
+            } else {
+                hittable_pdf light_pdf(lights, rec.p);
+                mixture_pdf p(light_pdf, *srec.pdf_ptr());
+
+                ray scattered = rec.spawn_ray(p.generate(), r.time());
+                auto pdf_value = p.value(scattered.direction());
+                double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+
+                path.throughput =
+                    path.throughput * srec.attenuation * scattering_pdf / pdf_value;
+                r = scattered;
+            }
+
+            if (!continue_path(path, stats))
+                break;
+        }
+
+        return path.radiance;
+    }
+
+    color trace_path_mis(
+        const ray& primary, const hittable& world, const hittable& lights,
+        path_statistics& stats, const packet_hits* primary_hits = nullptr, int lane = 0
+    ) const {
+        // Next event estimation. At every bounce off a material with a pdf, one direction is
+        // drawn from the lights and one from the material. Both see the light that arrives
+        // directly along them: emission from the first surface hit, or the background. Each
+        // sample is weighted with the power heuristic, so whichever strategy is better at
+        // finding a given direction dominates there. Light arriving after a skip_pdf material
+        // (metal, glass) can only be found by the path itself and keeps its full weight.
+
+        path_state path;
+        ray r = primary;
+
+        while (true) {
+            if (path.bounces >= max_depth) {
+                stats.record_end(path.bounces, stats.depth_limit);
+                break;
+            }
+
+            hit_record rec;
+            stats.rays++;
+
+            bool found = (primary_hits && path.bounces == 0)
+                       ? primary_hits->get(lane, rec)
+                       : world.hit(r, interval(0, infinity), rec);
+            if (!found) {
+                auto weight = scattered_weight(path, r, lights);
+                path.radiance += path.throughput * background * weight;
+                stats.record_end(path.bounces, stats.escaped);
+                break;
+            }
+
+            path.bounces++;
+
+            auto emitted = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+            if (!is_black(emitted))
+                path.radiance += path.throughput * emitted * scattered_weight(path, r, lights);
+
+            scatter_record srec;
+            if (!rec.mat->scatter(r, rec, srec)) {
+                stats.record_end(path.bounces, stats.absorbed);
+                break;
+            }
+
+            if (srec.skip_pdf) {
+                path.throughput = path.throughput * srec.attenuation;
+                path.specular = true;
+                r = srec.skip_pdf_ray;
+            } else {
+                const pdf& material_pdf = *srec.pdf_ptr();
+
+                // Light sample
+                auto to_light = rec.spawn_ray(lights.random(rec.p), r.time());
+                auto light_pdf = lights.pdf_value(to_light.origin(), to_light.direction());
+                auto light_scattering_pdf = rec.mat->scattering_pdf(r, rec, to_light);
+
+                if (light_pdf > 0 && light_scattering_pdf > 0) {
+                    auto incoming = direct_light(to_light, world, stats);
+                    if (!is_black(incoming)) {
+                        auto weight = power_heuristic(
+                            light_pdf, material_pdf.value(to_light.direction()));
+                        path.radiance += path.throughput * srec.attenuation * incoming
+                                       * (light_scattering_pdf * weight / light_pdf);
+                    }
+                }
+
+                // Material sample, which also continues the path
+                auto scattered = rec.spawn_ray(material_pdf.generate(), r.time());
+                auto scatter_pdf = material_pdf.value(scattered.direction());
+                auto scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+
+                if (scatter_pdf <= 0) {
+                    stats.record_end(path.bounces, stats.zero_throughput);
+                    break;
+                }
+
+                path.throughput =
+                    path.throughput * srec.attenuation * scattering_pdf / scatter_pdf;
+                path.specular = false;
+                path.scatter_from = scattered.origin();
+                path.scatter_pdf = scatter_pdf;
+                r = scattered;
+            }
+
+            if (!continue_path(path, stats))
+                break;
+        }
+
+        return path.radiance;
+    }
+
+    struct camera_sample {
+        // One sample to trace: its pixel, its index among the pixel's samples, and its
+        // stratum of a grid x grid subdivision of the pixel (see pixel_offset).
+        int      i, j;
+        uint64_t index;
+        int      stratum, grid;
+    };
+
+    struct wavefront_queue {
+        // The paths of a wavefront batch, one array per field, so that each stage streams
+        // through just the fields it uses. Paths are numbered by their position in the batch,
+        // and the index lists hold the paths waiting for a stage.
+
+        std::vector<sample_sequence> sequences;  // Where each path is in its sample's numbers
+        std::vector<ray>             rays;       // The ray each path traces next
+        std::vector<path_state>      states;
+        std::vector<hit_record>      hits;
+        std::vector<char>            found;      // Whether the ray hit anything
+        std::vector<scatter_record>  scatters;   // Kept for the material sample
+
+        std::vector<ray>    shadow_rays;     // The light samples taken while shading
+        std::vector<size_t> shadow_paths;    // The path of each light sample
+        std::vector<color>  shadow_weights;  // Path throughput times material attenuation
+        std::vector<double> shadow_scales;   // The pdf ratio and MIS weight of the sample
+
+        struct sort_key {
+            uintptr_t       type;  // Identifies the material's dynamic type, 0 for misses
+            const material* mat;
+            size_t          path;
+        };
+        std::vector<sort_key> order;
+
+        std::vector<size_t> tracing;   // Paths with a ray to trace
+        std::vector<size_t> sampling;  // Paths waiting for their material sample
+        std::vector<size_t> next;      // Paths with a ray for the next round
+
+        void resize(size_t n) {
+            sequences.resize(n);
+            rays.resize(n);
+            states.resize(n);
+            hits.resize(n);
+            found.resize(n);
+            scatters.resize(n);
+        }
+    };
+
+    static constexpr size_t wavefront_batch = 4096;  // Paths in flight per thread
+
+    std::vector<color> trace_wavefront(
+        const std::vector<camera_sample>& samples, const hittable& world,
+        const hittable& lights, path_statistics& stats
+    ) const {
+        // Returns the colors of the samples, traced with the estimator of trace_path_mis but
+        // a stage at a time over batches of paths instead of a path at a time. Every round,
+        // the rays of all live paths are intersected, the hits are sorted by material and
+        // shaded, the light samples of all paths are traced, and then the material samples
+        // are taken. Each stage runs one piece of code over many paths, and the sort lets
+        // runs of hits share a material's code and data.
+        //
+        // Paths carry their sample sequences from stage to stage and draw their numbers in
+        // the order trace_path_mis does, so the two integrators render the same image.
+
+        static thread_local wavefront_queue q;  // Reused, so batches don't allocate
+        auto& sequence = thread_sampler();
+        std::vector<color> radiance(samples.size());
+
+        for (size_t first = 0; first < samples.size(); first += wavefront_batch) {
+            auto count = std::min(wavefront_batch, samples.size() - first);
+            q.resize(count);
+
+            q.tracing.clear();
+            for (size_t p = 0; p < count; p++) {
+                const auto& sample = samples[first + p];
+                auto pixel = size_t(sample.j) * image_width + sample.i;
+                sequence.start(sampler, seed, pixel, sample.index);
+                auto offset = pixel_offset(sample.stratum, sample.grid);
+                q.rays[p] = get_ray(sample.i, sample.j, offset);
+                q.states[p] = path_state();
+                q.sequences[p] = sequence;
+                q.tracing.push_back(p);
+            }
+
+            while (!q.tracing.empty()) {
+                wavefront_intersect(q, world, stats);
+                wavefront_sort(q);
+                wavefront_shade(q, lights, stats);
+                wavefront_light_samples(q, world, stats);
+                wavefront_material_samples(q, stats);
+                q.tracing.swap(q.next);
+            }
+
+            for (size_t p = 0; p < count; p++)
+                radiance[first + p] = q.states[p].radiance;
+        }
+
+        return radiance;
+    }
+
+    void wavefront_intersect(
+        wavefront_queue& q, const hittable& world, path_statistics& stats
+    ) const {
+        // Ends the paths that reached max_depth and finds the closest hit of all the others.
+
+        auto& sequence = thread_sampler();
+        size_t kept = 0;
+        for (auto p : q.tracing) {
+            const auto& path = q.states[p];
+            if (path.bounces >= max_depth) {
+                stats.record_end(path.bounces, stats.depth_limit);
+                continue;
+            }
+
+            sequence = q.sequences[p];  // Volumes draw numbers to place their hits
+            stats.rays++;
+            q.found[p] = world.hit(q.rays[p], interval(0, infinity), q.hits[p]);
+            q.sequences[p] = sequence;
+            q.tracing[kept++] = p;
+        }
+        q.tracing.resize(kept);
+    }
+
+    static void wavefront_sort(wavefront_queue& q) {
+        // Orders the traced paths by the type of material they hit, then by the material
+        // itself, with the misses first. The sort is stable, so each group keeps its paths in
+        // their previous order and walks the queue's arrays mostly forward. The address of the
+        // type_info stands in for the type, since hashing the type's name for every path
+        // would cost more than the sort saves.
+
+        q.order.clear();
+        for (auto p : q.tracing) {
+            const material* mat = q.found[p] ? q.hits[p].mat : nullptr;
+            auto type = mat ? reinterpret_cast<uintptr_t>(&typeid(*mat)) : 0;
+            q.order.push_back({type, mat, p});
+        }
+
+        std::stable_sort(q.order.begin(), q.order.end(), [](const auto& a, const auto& b) {
+            if (a.type != b.type) return a.type < b.type;
+            return std::less<const material*>()(a.mat, b.mat);
+        });
+
+        for (size_t n = 0; n < q.order.size(); n++)
+            q.tracing[n] = q.order[n].path;
+    }
+
+    void wavefront_shade(wavefront_queue& q, const hittable& lights, path_statistics& stats)
+    const {
+        // Gathers emission and the background, ends the paths that escaped or were absorbed,
+        // and takes the light samples. Paths off skip_pdf materials go straight on to the
+        // next round; the others wait for their light and material samples.
+
+        auto& sequence = thread_sampler();
+        q.shadow_rays.clear();
+        q.shadow_paths.clear();
+        q.shadow_weights.clear();
+        q.shadow_scales.clear();
+        q.sampling.clear();
+        q.next.clear();
+
+        for (auto p : q.tracing) {
+            auto& path = q.states[p];
+            const auto& r = q.rays[p];
+            const auto& rec = q.hits[p];
+            sequence = q.sequences[p];
+
+            if (!q.found[p]) {
+                auto weight = scattered_weight(path, r, lights);
+                path.radiance += path.throughput * background * weight;
+                stats.record_end(path.bounces, stats.escaped);
+                continue;
+            }
+
+            path.bounces++;
+
+            auto emitted = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+            if (!is_black(emitted))
+                path.radiance += path.throughput * emitted * scattered_weight(path, r, lights);
+
+            auto& srec = q.scatters[p];
+            if (!rec.mat->scatter(r, rec, srec)) {
+                stats.record_end(path.bounces, stats.absorbed);
+                continue;
+            }
+
+            if (srec.skip_pdf) {
+                path.throughput = path.throughput * srec.attenuation;
+                path.specular = true;
+                q.rays[p] = srec.skip_pdf_ray;
+                if (continue_path(path, stats))
+                    q.next.push_back(p);
+            } else {
+                auto to_light = rec.spawn_ray(lights.random(rec.p), r.time());
+                auto light_pdf = lights.pdf_value(to_light.origin(), to_light.direction());
+                auto light_scattering_pdf = rec.mat->scattering_pdf(r, rec, to_light);
+
+                if (light_pdf > 0 && light_scattering_pdf > 0) {
+                    auto weight = power_heuristic(
+                        light_pdf, srec.pdf_ptr()->value(to_light.direction()));
+                    q.shadow_rays.push_back(to_light);
+                    q.shadow_paths.push_back(p);
+                    q.shadow_weights.push_back(path.throughput * srec.attenuation);
+                    q.shadow_scales.push_back(light_scattering_pdf * weight / light_pdf);
+                }
+                q.sampling.push_back(p);
+            }
+
+            q.sequences[p] = sequence;
+        }
+    }
+
+    void wavefront_light_samples(
+        wavefront_queue& q, const hittable& world, path_statistics& stats
+    ) const {
+        // Adds the light that each light sample ray finds to its path.
+
+        auto& sequence = thread_sampler();
+        for (size_t n = 0; n < q.shadow_rays.size(); n++) {
+            auto p = q.shadow_paths[n];
+            sequence = q.sequences[p];
+            auto incoming = direct_light(q.shadow_rays[n], world, stats);
+            q.sequences[p] = sequence;
+
+            if (!is_black(incoming))
+                q.states[p].radiance += q.shadow_weights[n] * incoming * q.shadow_scales[n];
+        }
+    }
+
+    void wavefront_material_samples(wavefront_queue& q, path_statistics& stats) const {
+        // Continues the shaded paths in the directions their materials' pdfs pick.
+
+        auto& sequence = thread_sampler();
+        for (auto p : q.sampling) {
+            auto& path = q.states[p];
+            auto& r = q.rays[p];
+            const auto& rec = q.hits[p];
+            const auto& srec = q.scatters[p];
+            const pdf& material_pdf = *srec.pdf_ptr();
+
+            sequence = q.sequences[p];
+
+            auto scattered = rec.spawn_ray(material_pdf.generate(), r.time());
+            auto scatter_pdf = material_pdf.value(scattered.direction());
+            auto scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+
+            if (scatter_pdf <= 0) {
+                stats.record_end(path.bounces, stats.zero_throughput);
+                continue;
+            }
+
+            path.throughput = path.throughput * srec.attenuation * scattering_pdf / scatter_pdf;
+            path.specular = false;
+            path.scatter_from = scattered.origin();
+            path.scatter_pdf = scatter_pdf;
+            r = scattered;
+
+            if (continue_path(path, stats))
+                q.next.push_back(p);
+            q.sequences[p] = sequence;
+        }
+    }
+
+    color direct_light(const ray& r, const hittable& world, path_statistics& stats) const {
+        // Returns the light arriving along the light sample ray r straight from the first
+        // surface it hits, or from the background if it hits nothing. The sampled point of
+        // the light lies at t = 1 (see hittable::random), so anything the any-hit query finds
+        // short of it blocks the sample, and only unblocked samples look for the surface they
+        // reach. Blockers count as dark, so no emitter should stand in front of a light.
+
+        constexpr double reach = 1 - 1e-4;  // Short of the sampled point by more than rounding
+        hit_record rec;
+        stats.rays++;
+        if (world.occluded(r, interval(0, reach)))
+            return color(0,0,0);
+        if (!world.hit(r, interval(reach, infinity), rec))
+            return background;
+        return rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+    }
+
+    static double scattered_weight(
+        const path_state& path, const ray& r, const hittable& lights
+    ) {
+        // MIS weight of light found by a ray that a material sample scattered, given that the
+        // light sample taken at the same bounce could have found it too.
+        if (path.specular)
+            return 1;
+        auto light_pdf = lights.pdf_value(path.scatter_from, r.direction());
+        return power_heuristic(path.scatter_pdf, light_pdf);
+    }
+
+    static double power_heuristic(double pdf, double other_pdf) {
+        auto a = pdf * pdf;
+        auto b = other_pdf * other_pdf;
+        return a / (a + b);
+    }
+
+    static bool is_black(const color& c) {
+        return c.x() <= 0 && c.y() <= 0 && c.z() <= 0;
+    }
+
+    bool continue_path(path_state& path, path_statistics& stats) const {
+        // Ends paths that can no longer contribute, and plays Russian roulette with the rest.
+        // Returns whether the path goes on.
+
+        // Nothing the rest of a path with zero throughput finds can contribute, so stop
+        // tracing it. The mixture integrator gets here whenever it picks a light sample that
+        // points below the surface, since that direction has no scattering pdf.
+        const auto& t = path.throughput;
+        auto max_throughput = std::fmax(t.x(), std::fmax(t.y(), t.z()));
+        if (max_throughput <= 0) {
+            stats.record_end(path.bounces, stats.zero_throughput);
+            return false;
+        }
+
+        // Russian roulette: past the first few bounces, a path survives with probability
+        // equal to its largest throughput component, and survivors are reweighted by the
+        // inverse of that probability, which keeps the estimate unbiased. The lower bound
+        // caps that reweighting; without it, the rare survivors of very dim paths turn
+        // into fireflies that cost more in noise than the shorter paths save in time.
+        if (russian_roulette && path.bounces >= roulette_depth) {
+            auto survival = std::fmax(max_throughput, roulette_min_survival);
+            if (survival < 1) {
+                if (random_double() >= survival) {
+                    stats.record_end(path.bounces, stats.roulette);
+                    return false;
+                }
+                path.throughput = path.throughput / survival;
+            }
+        }
+
+        return true;
+    }
 };
 
 
@@ -27,29 +27,31 @@ inline double linear_to_gamma(double linear_component)
 }
 
 
+inline void color_to_bytes(const color& pixel_color, unsigned char* rgb) {
+    // Converts a linear pixel color to the three gamma-encoded bytes of an 8-bit image.
+
+    for (int c = 0; c < 3; c++) {
+        auto component = pixel_color[c];
+
+        // Replace NaN components with zero.
+        if (component != component) component = 0.0;
+
+        // Apply a linear to gamma transform for gamma 2
+        component = linear_to_gamma(component);
+
+        // Translate the [0,1] component value to the byte range [0,255].
+        static const interval intensity(0.000, 0.999);
+        rgb[c] = static_cast<unsigned char>(256 * intensity.clamp(component));
+    }
+}
+
+
 void write_color(std::ostream& out, const color& pixel_color) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-    // Replace NaN components with zero.
-    if (r != r) r = 0.0;
-    if (g != g) g = 0.0;
-    if (b != b) b = 0.0;
-
-    // Apply a linear to gamma transform for gamma 2
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
-
-    // Translate the [0,1] component values to the byte range [0,255].
-    static const interval intensity(0.000, 0.999);
-    int rbyte = int(256 * intensity.clamp(r));
-    int gbyte = int(256 * intensity.clamp(g));
-    int bbyte = int(256 * intensity.clamp(b));
+    unsigned char rgb[3];
+    color_to_bytes(pixel_color, rgb);
 
     // Write out the pixel color components.
-    out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
+    out << int(rgb[0]) << ' ' << int(rgb[1]) << ' ' << int(rgb[2]) << '\n';
 }
 
 
@@ -34,8 +34,13 @@ class constant_medium : public hittable {
         if (!boundary->hit(r, interval::universe, rec1))
             return false;
 
-        if (!boundary->hit(r, interval(rec1.t+0.0001, infinity), rec2))
+        // The exit is searched for along a ray spawned just past the entry, which can't find
+        // the entry surface again at any scale. The spawned ray starts off r, so the exit
+        // point is projected back onto r for its distance.
+        auto inside = rec1.spawn_ray(r.direction(), r.time());
+        if (!boundary->hit(inside, interval(0, infinity), rec2))
             return false;
+        rec2.t = dot(rec2.p - r.origin(), r.direction()) / r.direction().length_squared();
 
         if (rec1.t < ray_t.min) rec1.t = ray_t.min;
         if (rec2.t > ray_t.max) rec2.t = ray_t.max;
@@ -56,9 +61,13 @@ class constant_medium : public hittable {
         rec.t = rec1.t + hit_distance / ray_length;
         rec.p = r.at(rec.t);
 
-        rec.normal = vec3(1,0,0);  // arbitrary
-        rec.front_face = true;     // also arbitrary
-        rec.mat = phase_function;
+        // A scattering point lies inside the volume, not on a surface that a ray leaving it
+        // could hit again, so it needs no offset. The zero normal makes spawn_ray start the
+        // scattered rays exactly at p, and the isotropic phase function never reads it.
+        rec.p_error = 0;
+        rec.normal = vec3(0,0,0);
+        rec.front_face = true;  // arbitrary
+        rec.mat = phase_function.get();
 
         return true;
     }
@@ -12,19 +12,31 @@
 //==============================================================================================
 
 #include "aabb.h"
+#include "ray_packet.h"
 
 
 class material;
 
 
+inline real largest_magnitude(const vec3& v) {
+    return std::fmax(std::fabs(v.x()), std::fmax(std::fabs(v.y()), std::fabs(v.z())));
+}
+
+inline real rounding_error(real magnitude) {
+    // Bounds the error left by a handful of rounded operations on numbers up to `magnitude`.
+    return 4 * std::numeric_limits<real>::epsilon() * magnitude;
+}
+
+
 class hit_record {
   public:
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
-    double t;
-    double u;
-    double v;
+    const material* mat;  // Owned by the object that was hit
+    real t;
+    real u;
+    real v;
+    real p_error;         // Bound on the distance from p to the surface
     bool front_face;
 
     void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -34,6 +46,49 @@ class hit_record {
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    ray spawn_ray(const vec3& direction, real time) const {
+        // Returns a ray leaving the surface at p. Its origin is moved off the surface along the
+        // normal, to the side the direction leaves through, by more than the error in p, so
+        // the ray can't find the surface it starts on again and is traced from t = 0. The
+        // offset scales with the size of the scene's coordinates, unlike a fixed minimum t.
+
+        auto offset = 2 * p_error + rounding_error(largest_magnitude(p));
+        if (dot(direction, normal) < 0)
+            offset = -offset;
+        return ray(p + offset * normal, direction, time);
+    }
+};
+
+
+struct packet_hits {
+    // The closest hits found so far for the rays of a packet. Bit k of `found` is set once
+    // ray k has hit something, recorded in recs[k]; t_max[k] is the distance of that hit, and
+    // limits the search for closer ones.
+
+    double     t_min;
+    double     t_max[packet_size];
+    hit_record recs[packet_size];
+    uint32_t   found = 0;
+
+    explicit packet_hits(interval ray_t) : t_min(ray_t.min) {
+        for (auto& t : t_max)
+            t = ray_t.max;
+    }
+
+    void record(int k) {
+        // Notes that recs[k] now holds a closer hit for ray k.
+        found |= 1u << k;
+        t_max[k] = recs[k].t;
+    }
+
+    bool get(int k, hit_record& rec) const {
+        // Copies out the hit of ray k, if it has one.
+        if (!(found & (1u << k)))
+            return false;
+        rec = recs[k];
+        return true;
+    }
 };
 
 
@@ -43,6 +98,31 @@ class hittable {
 
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
+    virtual void hit_packet(const ray_packet& packet, uint32_t lanes, packet_hits& hits) const {
+        // Looks for closer hits for the rays of the packet whose bits are set in `lanes`. This
+        // version tests the rays one at a time; shapes override it to test them side by side.
+
+        auto& sequence = thread_sampler();
+        for (int k = 0; k < packet.size(); k++) {
+            if (!(lanes & (1u << k)))
+                continue;
+            if (packet.sequences)
+                sequence = packet.sequences[k];
+            if (hit(packet.rays[k], interval(hits.t_min, hits.t_max[k]), hits.recs[k]))
+                hits.record(k);
+            if (packet.sequences)
+                packet.sequences[k] = sequence;
+        }
+    }
+
+    virtual bool occluded(const ray& r, interval ray_t) const {
+        // Returns true if r hits anything within ray_t. Unlike hit(), this may stop at the
+        // first hit it finds and skip the point, normal, texture coordinates and material;
+        // shapes and acceleration structures override it to do so.
+        hit_record rec;
+        return hit(r, ray_t, rec);
+    }
+
     virtual aabb bounding_box() const = 0;
 
     virtual double pdf_value(const point3& origin, const vec3& direction) const {
@@ -50,6 +130,8 @@ class hittable {
     }
 
     virtual vec3 random(const point3& origin) const {
+        // Returns a direction from origin toward a random point of the shape. Shapes make it
+        // just long enough to reach that point, which lies at t = 1 along the direction.
         return vec3(1,0,0);
     }
 };
@@ -73,10 +155,15 @@ class translate : public hittable {
 
         // Move the intersection point forwards by the offset
         rec.p += offset;
+        rec.p_error += rounding_error(largest_magnitude(rec.p));
 
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+    }
+
     aabb bounding_box() const override { return bbox; }
 
   private:
@@ -124,19 +211,7 @@ class rotate_y : public hittable {
 
         // Transform the ray from world space to object space.
 
-        auto origin = point3(
-            (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
-            r.origin().y(),
-            (sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
-        );
-
-        auto direction = vec3(
-            (cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
-            r.direction().y(),
-            (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
-        );
-
-        ray rotated_r(origin, direction, r.time());
+        ray rotated_r = to_object_space(r);
 
         // Determine whether an intersection exists in object space (and if so, where).
 
@@ -150,6 +225,7 @@ class rotate_y : public hittable {
             rec.p.y(),
             (-sin_theta * rec.p.x()) + (cos_theta * rec.p.z())
         );
+        rec.p_error += rounding_error(largest_magnitude(rec.p));
 
         rec.normal = vec3(
             (cos_theta * rec.normal.x()) + (sin_theta * rec.normal.z()),
@@ -160,6 +236,10 @@ class rotate_y : public hittable {
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(to_object_space(r), ray_t);
+    }
+
     aabb bounding_box() const override { return bbox; }
 
   private:
@@ -167,6 +247,22 @@ class rotate_y : public hittable {
     double sin_theta;
     double cos_theta;
     aabb bbox;
+
+    ray to_object_space(const ray& r) const {
+        auto origin = point3(
+            (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
+            r.origin().y(),
+            (sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
+        );
+
+        auto direction = vec3(
+            (cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
+            r.direction().y(),
+            (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
+        );
+
+        return ray(origin, direction, r.time());
+    }
 };
 
 
@@ -47,6 +47,21 @@ class hittable_list : public hittable {
         return hit_anything;
     }
 
+    void hit_packet(
+        const ray_packet& packet, uint32_t lanes, packet_hits& hits
+    ) const override {
+        for (const auto& object : objects)
+            object->hit_packet(packet, lanes, hits);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, ray_t))
+                return true;
+        }
+        return false;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
     double pdf_value(const point3& origin, const vec3& direction) const override {
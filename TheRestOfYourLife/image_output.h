@@ -0,0 +1,255 @@
+#ifndef IMAGE_OUTPUT_H
+#define IMAGE_OUTPUT_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "color.h"
+
+// Disable strict warnings for this header from the Microsoft Visual C++ compiler.
+#ifdef _MSC_VER
+    #pragma warning (push, 0)
+#endif
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../external/stb_image_write.h"
+
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define RTW_MAPPED_OUTPUT
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+
+enum class image_format {
+    ppm_ascii,   // Plain text P3 PPM
+    ppm_binary,  // Binary P6 PPM
+    png,         // 8-bit PNG
+    pfm          // Linear 32-bit float PFM, for HDR viewers and compositing
+};
+
+
+inline bool has_extension(const std::string& filename, const std::string& extension) {
+    if (filename.size() < extension.size())
+        return false;
+
+    auto tail = filename.substr(filename.size() - extension.size());
+    for (auto& c : tail)
+        c = char(std::tolower(static_cast<unsigned char>(c)));
+    return tail == extension;
+}
+
+
+inline image_format image_format_for(const std::string& filename) {
+    // Picks the output format from the file extension: .ppm files are binary P6, .png and
+    // .pfm files are what they say, and any other name gets a plain text P3 PPM.
+
+    if (has_extension(filename, ".ppm")) return image_format::ppm_binary;
+    if (has_extension(filename, ".png")) return image_format::png;
+    if (has_extension(filename, ".pfm")) return image_format::pfm;
+    return image_format::ppm_ascii;
+}
+
+
+inline std::vector<unsigned char> image_bytes(const std::vector<color>& pixels) {
+    // Returns the gamma-encoded RGB bytes of a row-major buffer of linear pixel colors.
+
+    std::vector<unsigned char> bytes(3 * pixels.size());
+    for (size_t k = 0; k < pixels.size(); k++)
+        color_to_bytes(pixels[k], &bytes[3 * k]);
+    return bytes;
+}
+
+
+inline bool write_ppm_ascii(
+    const std::string& filename, const std::vector<color>& pixels, int width, int height
+) {
+    // Formats the whole image into one string and writes it at once.
+
+    auto bytes = image_bytes(pixels);
+
+    auto text = "P3\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+    auto header_size = text.size();
+    text.resize(header_size + 12 * pixels.size());  // At most "255 255 255\n" per pixel
+
+    auto next = &text[header_size];
+    auto end = text.data() + text.size();
+    for (size_t k = 0; k < bytes.size(); k++) {
+        next = std::to_chars(next, end, int(bytes[k])).ptr;
+        *next++ = (k % 3 == 2) ? '\n' : ' ';
+    }
+    text.resize(next - text.data());
+
+    std::ofstream out(filename, std::ios::binary);
+    out.write(text.data(), std::streamsize(text.size()));
+    return bool(out);
+}
+
+
+inline bool write_ppm_binary(
+    const std::string& filename, const std::vector<color>& pixels, int width, int height
+) {
+    auto bytes = image_bytes(pixels);
+
+    std::ofstream out(filename, std::ios::binary);
+    out << "P6\n" << width << ' ' << height << "\n255\n";
+    out.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+    return bool(out);
+}
+
+
+inline bool write_png(
+    const std::string& filename, const std::vector<color>& pixels, int width, int height
+) {
+    auto bytes = image_bytes(pixels);
+    return stbi_write_png(filename.c_str(), width, height, 3, bytes.data(), 3 * width) != 0;
+}
+
+
+inline bool write_pfm(
+    const std::string& filename, const std::vector<color>& pixels, int width, int height
+) {
+    // Writes the linear colors as 32-bit floats in the machine's byte order, which the
+    // header's scale announces by its sign (negative for little endian). PFM rows run from
+    // the bottom of the image to the top.
+
+    const uint16_t probe = 1;
+    unsigned char first_byte;
+    std::memcpy(&first_byte, &probe, 1);
+    auto scale = (first_byte == 1) ? "-1.0" : "1.0";
+
+    std::vector<float> floats(3 * pixels.size());
+    for (int j = 0; j < height; j++) {
+        auto row = &floats[3 * size_t(height - 1 - j) * width];
+        for (int i = 0; i < width; i++) {
+            for (int c = 0; c < 3; c++) {
+                auto component = pixels[size_t(j) * width + i][c];
+                row[3 * i + c] = (component == component) ? float(component) : 0.0f;
+            }
+        }
+    }
+
+    std::ofstream out(filename, std::ios::binary);
+    out << "PF\n" << width << ' ' << height << '\n' << scale << '\n';
+    out.write(
+        reinterpret_cast<const char*>(floats.data()), std::streamsize(floats.size() * 4));
+    return bool(out);
+}
+
+
+inline bool write_image(
+    const std::string& filename, const std::vector<color>& pixels, int width, int height
+) {
+    // Writes a row-major buffer of linear pixel colors in the format the file name selects.
+    // Returns false, after reporting why, if the file couldn't be written.
+
+    bool written = false;
+    switch (image_format_for(filename)) {
+        case image_format::ppm_ascii:
+            written = write_ppm_ascii(filename, pixels, width, height);
+            break;
+        case image_format::ppm_binary:
+            written = write_ppm_binary(filename, pixels, width, height);
+            break;
+        case image_format::png:
+            written = write_png(filename, pixels, width, height);
+            break;
+        case image_format::pfm:
+            written = write_pfm(filename, pixels, width, height);
+            break;
+    }
+
+    if (!written)
+        log_line(std::cerr, "Could not write the image file ", filename, '\n');
+    return written;
+}
+
+
+class mapped_ppm {
+  // A binary P6 file that is sized up front and mapped into memory, so that any thread can
+  // store any part of the image straight into the file as soon as it has the pixels. Where
+  // memory mapped files aren't available, is_open() is false and callers should fall back to
+  // write_image.
+  public:
+    mapped_ppm(const std::string& filename, int width, int height) : width(width) {
+      #ifdef RTW_MAPPED_OUTPUT
+        auto header = "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+        header_size = header.size();
+        size = header_size + 3 * size_t(width) * size_t(height);
+
+        file = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (file < 0)
+            return;
+
+        if (ftruncate(file, off_t(size)) == 0) {
+            auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+            if (mapping != MAP_FAILED) {
+                data = static_cast<unsigned char*>(mapping);
+                std::memcpy(data, header.data(), header_size);
+            }
+        }
+      #else
+        (void)filename;
+        (void)height;
+      #endif
+    }
+
+    ~mapped_ppm() {
+      #ifdef RTW_MAPPED_OUTPUT
+        if (data)
+            munmap(data, size);
+        if (file >= 0)
+            close(file);
+      #endif
+    }
+
+    mapped_ppm(const mapped_ppm&) = delete;
+    mapped_ppm& operator=(const mapped_ppm&) = delete;
+
+    bool is_open() const { return data != nullptr; }
+
+    void write_pixels(
+        const std::vector<color>& pixels, int start_i, int start_j, int end_i, int end_j
+    ) {
+        // Stores the given rectangle of a row-major buffer of linear pixel colors. Threads may
+        // write disjoint rectangles at the same time.
+
+        for (int j = start_j; j < end_j; j++) {
+            auto row = size_t(j) * width;
+            auto out = data + header_size + 3 * (row + start_i);
+            for (int i = start_i; i < end_i; i++, out += 3)
+                color_to_bytes(pixels[row + i], out);
+        }
+    }
+
+  private:
+    int            width;
+    size_t         header_size = 0;
+    size_t         size        = 0;
+    unsigned char* data        = nullptr;
+    int            file        = -1;
+};
+
+
+// Restore MSVC compiler warnings
+#ifdef _MSC_VER
+    #pragma warning (pop)
+#endif
+
+
+#endif
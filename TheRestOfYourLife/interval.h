@@ -10,54 +10,67 @@
 //==============================================================================================
 
 
-class interval {
+template <typename T>
+class basic_interval {
   public:
-    double min, max;
+    using value_type = T;
 
-    interval() : min(+infinity), max(-infinity) {} // Default interval is empty
+    T min, max;
 
-    interval(double min, double max) : min(min), max(max) {}
+    basic_interval() : min(+infinity), max(-infinity) {} // Default interval is empty
 
-    interval(const interval& a, const interval& b) {
+    basic_interval(T min, T max) : min(min), max(max) {}
+
+    basic_interval(const basic_interval& a, const basic_interval& b) {
         // Create the interval tightly enclosing the two input intervals.
         min = a.min <= b.min ? a.min : b.min;
         max = a.max >= b.max ? a.max : b.max;
     }
 
-    double size() const {
+    T size() const {
         return max - min;
     }
 
-    bool contains(double x) const {
+    bool contains(T x) const {
         return min <= x && x <= max;
     }
 
-    bool surrounds(double x) const {
+    bool surrounds(T x) const {
         return min < x && x < max;
     }
 
-    double clamp(double x) const {
+    T clamp(T x) const {
         if (x < min) return min;
         if (x > max) return max;
         return x;
     }
 
-    interval expand(double delta) const {
+    basic_interval expand(T delta) const {
         auto padding = delta/2;
-        return interval(min - padding, max + padding);
+        return basic_interval(min - padding, max + padding);
     }
 
-    static const interval empty, universe;
+    static const basic_interval empty, universe;
 };
 
-const interval interval::empty    = interval(+infinity, -infinity);
-const interval interval::universe = interval(-infinity, +infinity);
+template <typename T>
+const basic_interval<T> basic_interval<T>::empty    = basic_interval<T>(+infinity, -infinity);
+template <typename T>
+const basic_interval<T> basic_interval<T>::universe = basic_interval<T>(-infinity, +infinity);
+
+using interval = basic_interval<real>;
 
-interval operator+(const interval& ival, double displacement) {
-    return interval(ival.min + displacement, ival.max + displacement);
+template <typename T>
+basic_interval<T> operator+(
+    const basic_interval<T>& ival, typename basic_interval<T>::value_type displacement
+) {
+    return basic_interval<T>(ival.min + displacement, ival.max + displacement);
 }
 
-interval operator+(double displacement, const interval& ival) {
+template <typename T>
+basic_interval<T> operator+(
+    typename basic_interval<T>::value_type displacement, const basic_interval<T>& ival
+) {
     return ival + displacement;
 }
 
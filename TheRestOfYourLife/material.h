@@ -15,13 +15,23 @@
 #include "pdf.h"
 #include "texture.h"
 
+#include <variant>
+
 
 class scatter_record {
   public:
     color attenuation;
-    shared_ptr<pdf> pdf_ptr;
+    std::variant<std::monostate, cosine_pdf, sphere_pdf> pdf_storage;
     bool skip_pdf;
     ray skip_pdf_ray;
+
+    const pdf* pdf_ptr() const {
+        // Returns the scattering distribution held inline in pdf_storage, or null if the
+        // material didn't set one. Keeping it inline means scattering never allocates.
+        if (auto p = std::get_if<cosine_pdf>(&pdf_storage)) return p;
+        if (auto p = std::get_if<sphere_pdf>(&pdf_storage)) return p;
+        return nullptr;
+    }
 };
 
 
@@ -53,7 +63,7 @@ class lambertian : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+        srec.pdf_storage.emplace<cosine_pdf>(rec.normal);
         srec.skip_pdf = false;
         return true;
     }
@@ -78,9 +88,8 @@ class metal : public material {
         reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
 
         srec.attenuation = albedo;
-        srec.pdf_ptr = nullptr;
         srec.skip_pdf = true;
-        srec.skip_pdf_ray = ray(rec.p, reflected, r_in.time());
+        srec.skip_pdf_ray = rec.spawn_ray(reflected, r_in.time());
 
         return true;
     }
@@ -97,7 +106,6 @@ class dielectric : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = color(1.0, 1.0, 1.0);
-        srec.pdf_ptr = nullptr;
         srec.skip_pdf = true;
         double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
 
@@ -113,7 +121,7 @@ class dielectric : public material {
         else
             direction = refract(unit_direction, rec.normal, ri);
 
-        srec.skip_pdf_ray = ray(rec.p, direction, r_in.time());
+        srec.skip_pdf_ray = rec.spawn_ray(direction, r_in.time());
         return true;
     }
 
@@ -155,7 +163,7 @@ class isotropic : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<sphere_pdf>();
+        srec.pdf_storage.emplace<sphere_pdf>();
         srec.skip_pdf = false;
         return true;
     }
@@ -175,7 +183,7 @@ class snowball : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = albedo;
-        srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+        srec.pdf_storage.emplace<cosine_pdf>(rec.normal);
         srec.skip_pdf = false;
         return true;
     }
@@ -197,7 +205,7 @@ class snow : public material {
         const double white_bias = 0.3;
         srec.attenuation = (1.0 - white_bias) * albedo + white_bias * color(1.0, 1.0, 1.0);
         
-        srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+        srec.pdf_storage.emplace<cosine_pdf>(rec.normal);
         srec.skip_pdf = false;
         
         return true;
@@ -223,7 +231,7 @@ class rock : public material {
         
         srec.attenuation = albedo;
         srec.skip_pdf = true;
-        srec.skip_pdf_ray = ray(rec.p, scattered_direction, r_in.time());
+        srec.skip_pdf_ray = rec.spawn_ray(scattered_direction, r_in.time());
 
         return dot(srec.skip_pdf_ray.direction(), rec.normal) > 0;
     }
@@ -0,0 +1,146 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Measures the speedup of tracing camera rays in packets, on the bouncing spheres scene from
+// TheNextWeek and on the Cornell box. Primary visibility traces eight jittered camera rays per
+// pixel through the SAH BVH, one at a time and then as one packet per pixel, and checks that
+// both find the same hits. The render compares a single-threaded next event render of the
+// bouncing spheres with and without ray_packets.
+
+#include "rtweekend.h"
+
+#include "bench_scenes.h"
+#include "bvh.h"
+#include "camera.h"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+bool same_hit(const hit_record& a, const hit_record& b) {
+    return a.t == b.t && a.mat == b.mat && a.front_face == b.front_face && a.u == b.u
+        && a.v == b.v && a.p[0] == b.p[0] && a.p[1] == b.p[1] && a.p[2] == b.p[2]
+        && a.normal[0] == b.normal[0] && a.normal[1] == b.normal[1]
+        && a.normal[2] == b.normal[2];
+}
+
+
+void primary_visibility(const bench_scene& scene) {
+    // Eight rays per pixel of a 400 pixel wide image, with a pixel's rays next to each other.
+
+    linear_bvh bvh(scene.world);
+
+    const auto& cam = scene.cam;
+    auto lookfrom = cam.lookfrom;
+    auto aspect_ratio = cam.aspect_ratio;
+    int width = 400;
+    int height = int(width / aspect_ratio);
+    auto w = unit_vector(lookfrom - cam.lookat);
+    auto u = unit_vector(cross(vec3(0,1,0), w));
+    auto v = cross(w, u);
+    auto h = std::tan(degrees_to_radians(cam.vfov) / 2);
+
+    std::vector<ray> rays;
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            for (int s = 0; s < packet_size; s++) {
+                auto sx = (2 * (i + random_double()) / width - 1) * h * aspect_ratio;
+                auto sy = (1 - 2 * (j + random_double()) / height) * h;
+                rays.push_back(ray(lookfrom, sx*u + sy*v - w, random_double()));
+            }
+        }
+    }
+
+    std::vector<hit_record> single(rays.size()), packed(rays.size());
+    std::vector<char> single_found(rays.size()), packed_found(rays.size());
+    double single_seconds = infinity, packet_seconds = infinity;
+
+    for (int trial = 0; trial < 5; trial++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < rays.size(); n++)
+            single_found[n] = bvh.hit(rays[n], interval(0, infinity), single[n]);
+
+        auto middle = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < rays.size(); n += packet_size) {
+            ray_packet packet;
+            for (int k = 0; k < packet_size; k++)
+                packet.add(rays[n + k]);
+
+            packet_hits hits(interval(0, infinity));
+            bvh.hit_packet(packet, packet.all_lanes(), hits);
+            for (int k = 0; k < packet_size; k++)
+                packed_found[n + k] = hits.get(k, packed[n + k]);
+        }
+        auto stop = std::chrono::steady_clock::now();
+
+        single_seconds = std::fmin(
+            single_seconds, std::chrono::duration<double>(middle - start).count());
+        packet_seconds = std::fmin(
+            packet_seconds, std::chrono::duration<double>(stop - middle).count());
+    }
+
+    size_t mismatches = 0;
+    for (size_t n = 0; n < rays.size(); n++) {
+        if (single_found[n] != packed_found[n]
+            || (single_found[n] && !same_hit(single[n], packed[n])))
+            mismatches++;
+    }
+
+    auto count = double(rays.size());
+    std::cout << std::left << std::setw(18) << scene.name << std::right << std::fixed
+              << std::setprecision(2) << "single " << std::setw(6)
+              << count / single_seconds / 1e6
+              << " Mrays/s   packets " << std::setw(6) << count / packet_seconds / 1e6
+              << " Mrays/s   speedup " << single_seconds / packet_seconds
+              << "   mismatches " << mismatches << '\n';
+}
+
+
+void render(bench_scene scene) {
+    hittable_list world(make_shared<linear_bvh>(scene.world));
+    const auto& lights = scene.lights;
+
+    auto& cam = scene.cam;
+    cam.samples_per_pixel = 16;
+    cam.max_depth         = 50;
+    cam.thread_count      = 1;
+
+    std::vector<color> images[2];
+    double best_seconds[2] = {infinity, infinity};
+    for (int trial = 0; trial < 3; trial++) {
+        for (int packets = 0; packets < 2; packets++) {
+            cam.ray_packets = packets == 1;
+            auto start = std::chrono::steady_clock::now();
+            images[packets] = cam.render_pixels(world, lights);
+            auto stop = std::chrono::steady_clock::now();
+            auto seconds = std::chrono::duration<double>(stop - start).count();
+            best_seconds[packets] = std::fmin(best_seconds[packets], seconds);
+        }
+    }
+
+    auto bytes = sizeof(color) * images[0].size();
+    bool same = std::memcmp(images[0].data(), images[1].data(), bytes) == 0;
+    std::cout << "render            single " << best_seconds[0] << " s   packets "
+              << best_seconds[1] << " s   speedup " << best_seconds[0] / best_seconds[1]
+              << "   images " << (same ? "identical" : "DIFFERENT") << '\n';
+}
+
+
+int main() {
+    auto spheres = bouncing_spheres();
+
+    std::cout << "SIMD width: " << vfloat::width << " floats, " << vdouble::width
+              << " doubles\n";
+    primary_visibility(spheres);
+    primary_visibility(cornell_box());
+    render(spheres);
+}
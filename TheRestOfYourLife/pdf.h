@@ -77,11 +77,10 @@ class hittable_pdf : public pdf {
 
 
 class mixture_pdf : public pdf {
+  // An equal mix of two distributions. The mixture only refers to its components, so they can
+  // live on the stack of the caller instead of being heap allocated for every bounce.
   public:
-    mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1) {
-        p[0] = p0;
-        p[1] = p1;
-    }
+    mixture_pdf(const pdf& p0, const pdf& p1) : p{&p0, &p1} {}
 
     double value(const vec3& direction) const override {
         return 0.5 * p[0]->value(direction) + 0.5 * p[1]->value(direction);
@@ -95,7 +94,7 @@ class mixture_pdf : public pdf {
     }
 
   private:
-    shared_ptr<pdf> p[2];
+    const pdf* p[2];
 };
 
 
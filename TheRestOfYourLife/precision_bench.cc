@@ -0,0 +1,105 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Compares rendering in single and double precision on the Cornell box from restLife.cc, the
+// first snowman view and the test.cc showcase (with a gray floor in place of the rock texture).
+// Build it twice, once with -DRTW_FLOAT, and run both from the same directory:
+//
+//     g++ -O2 -pthread precision_bench.cc -o precision_double
+//     g++ -O2 -pthread -DRTW_FLOAT precision_bench.cc -o precision_float
+//
+// Each run times single-threaded renders of the scenes and saves its images. When the images
+// of the other precision are there, it also reports how far apart the two are. Both render
+// with the same sample sequences, so their differences come from rounding alone, and are set
+// against those between two renders of this precision with different seeds: the change in
+// the mean against the seeds' change in the mean, and the mean absolute difference against
+// the seeds' noise.
+
+#include "rtweekend.h"
+
+#include "bench_scenes.h"
+#include "bvh.h"
+#include "camera.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+#if defined(RTW_FLOAT)
+const char* precision_name = "float";
+const char* other_precision_name = "double";
+#else
+const char* precision_name = "double";
+const char* other_precision_name = "float";
+#endif
+
+
+void bench(bench_scene scene) {
+    scene.world = hittable_list(make_shared<linear_bvh>(scene.world));
+
+    auto& cam = scene.cam;
+    cam.samples_per_pixel = 32;
+    cam.max_depth         = 50;
+    cam.thread_count      = 1;
+    cam.integrator        = path_integrator::next_event;
+
+    std::vector<color> image;
+    double best_seconds = infinity;
+    for (int trial = 0; trial < 3; trial++) {
+        auto start = std::chrono::steady_clock::now();
+        image = cam.render_pixels(scene.world, scene.lights);
+        auto stop = std::chrono::steady_clock::now();
+        best_seconds = std::fmin(best_seconds,
+                                 std::chrono::duration<double>(stop - start).count());
+    }
+
+    camera reseeded = cam;
+    reseeded.seed = 1;
+    auto second_seed = reseeded.render_pixels(scene.world, scene.lights);
+
+    auto prefix = std::string("precision_") + scene.file_name + '.';
+    save_image(prefix + precision_name, image);
+
+    auto mean = mean_value(image);
+    auto seed_change = 100 * (mean_value(second_seed) - mean) / mean;
+    auto samples = double(image.size()) * cam.samples_per_pixel;
+    std::cout << "== " << scene.name << '\n' << std::fixed << std::setprecision(3)
+              << precision_name << ": " << samples / best_seconds / 1e6 << " Msamples/s   mean "
+              << std::setprecision(5) << mean << "   next seed " << std::showpos
+              << std::setprecision(3) << seed_change << "%   " << std::noshowpos
+              << std::setprecision(5) << "seed noise "
+              << mean_abs_difference(image, second_seed) << '\n';
+
+    std::vector<color> other;
+    if (!load_image(prefix + other_precision_name, image.size(), other)) {
+        std::cout << "(no " << other_precision_name << " images yet)\n\n";
+        return;
+    }
+
+    auto other_mean = mean_value(other);
+    std::cout << "vs " << other_precision_name << ": mean " << other_mean << "   this "
+              << std::showpos << std::setprecision(3) << 100 * (mean - other_mean) / other_mean
+              << "%   " << std::noshowpos << std::setprecision(5) << "mean abs diff "
+              << mean_abs_difference(image, other) << "   rms diff "
+              << rms_difference(image, other) << "\n\n";
+}
+
+
+int main() {
+    std::cout << precision_name << ": sizeof(vec3) " << sizeof(vec3) << ", sizeof(ray) "
+              << sizeof(ray) << ", sizeof(aabb) " << sizeof(aabb) << ", sizeof(hit_record) "
+              << sizeof(hit_record) << "\n\n";
+
+    bench(cornell_box());
+    bench(snowman());
+    bench(showcase());
+}
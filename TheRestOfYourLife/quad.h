@@ -38,55 +38,112 @@ class quad : public hittable {
     aabb bounding_box() const override { return bbox; }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        auto denom = dot(normal, r.direction());
-
-        // No hit if the ray is parallel to the plane.
-        if (std::fabs(denom) < 1e-8)
-            return false;
-
-        // Return false if the hit point parameter t is outside the ray interval.
-        auto t = (D - dot(normal, r.origin())) / denom;
-        if (!ray_t.contains(t))
-            return false;
-
-        // Determine if the hit point lies within the planar shape using its plane coordinates.
-        auto intersection = r.at(t);
-        vec3 planar_hitpt_vector = intersection - Q;
-        auto alpha = dot(w, cross(planar_hitpt_vector, v));
-        auto beta = dot(w, cross(u, planar_hitpt_vector));
-
-        if (!is_interior(alpha, beta, rec))
+        double t;
+        real alpha, beta;
+        if (!locate(r, ray_t, t, alpha, beta, rec.u, rec.v))
             return false;
 
-        // Ray hits the 2D shape; set the rest of the hit record and return true.
+        // Ray hits the 2D shape; set the rest of the hit record and return true. The point is
+        // rebuilt from its plane coordinates, which puts it on the plane up to the rounding of
+        // the sum, however far the ray travelled to get there.
         rec.t = t;
-        rec.p = intersection;
-        rec.mat = mat;
+        rec.p = Q + alpha*u + beta*v;
+        auto extent = largest_magnitude(Q) + std::fabs(alpha)*largest_magnitude(u)
+                    + std::fabs(beta)*largest_magnitude(v);
+        rec.p_error = rounding_error(extent);
+        rec.mat = mat.get();
         rec.set_face_normal(r, normal);
 
         return true;
     }
 
-    virtual bool is_interior(double a, double b, hit_record& rec) const {
+    bool occluded(const ray& r, interval ray_t) const override {
+        double t;
+        real alpha, beta, tex_u, tex_v;
+        return locate(r, ray_t, t, alpha, beta, tex_u, tex_v);
+    }
+
+    void hit_packet(
+        const ray_packet& packet, uint32_t lanes, packet_hits& hits
+    ) const override {
+        // Intersects the plane with all the rays side by side, and completes the hits of the
+        // rays that reach it within their range with hit(), which also tests whether the
+        // point lies on the shape. Where hit() may round differently (see filter_tolerance),
+        // the range is widened by the error hit() can make in t, and hit() alone tests for
+        // rays parallel to the plane.
+
+        auto normal_x = vdouble::broadcast(normal.x());
+        auto normal_y = vdouble::broadcast(normal.y());
+        auto normal_z = vdouble::broadcast(normal.z());
+        auto plane = vdouble::broadcast(D);
+        auto parallel = vdouble::broadcast(1e-8);
+        auto t_min = vdouble::broadcast(hits.t_min);
+
+        uint32_t candidates = 0;
+        for (int k = 0; k < packet_size; k += vdouble::width) {
+            constexpr uint32_t chunk = (1u << vdouble::width) - 1;
+            if (!((lanes >> k) & chunk))
+                continue;
+
+            auto dir_x = vdouble::load(packet.direction[0] + k);
+            auto dir_y = vdouble::load(packet.direction[1] + k);
+            auto dir_z = vdouble::load(packet.direction[2] + k);
+            auto orig_x = vdouble::load(packet.origin[0] + k);
+            auto orig_y = vdouble::load(packet.origin[1] + k);
+            auto orig_z = vdouble::load(packet.origin[2] + k);
+
+            auto denom = normal_x * dir_x + normal_y * dir_y + normal_z * dir_z;
+            auto distance = normal_x * orig_x + normal_y * orig_y + normal_z * orig_z;
+            auto t = (plane - distance) / denom;
+            auto t_max = vdouble::load(hits.t_max + k);
+
+            if constexpr (filter_tolerance == 0) {
+                auto hit_lanes = less_equal_mask(parallel, abs(denom))
+                               & less_equal_mask(t_min, t) & less_equal_mask(t, t_max);
+                candidates |= hit_lanes << k;
+            } else {
+                auto tolerance = vdouble::broadcast(filter_tolerance);
+                auto origin_extent = abs(orig_x) + abs(orig_y) + abs(orig_z);
+                auto direction_extent = abs(dir_x) + abs(dir_y) + abs(dir_z);
+                auto numerator_extent = abs(plane) + origin_extent + abs(t) * direction_extent;
+                auto slack = tolerance * (numerator_extent / abs(denom) + abs(t));
+                auto hit_lanes = less_equal_mask(t_min - slack, t)
+                               & less_equal_mask(t, t_max + slack);
+                candidates |= hit_lanes << k;
+            }
+        }
+
+        candidates &= lanes;
+        for (int k = 0; k < packet.size(); k++) {
+            if (candidates & (1u << k)) {
+                if (hit(packet.rays[k], interval(hits.t_min, hits.t_max[k]), hits.recs[k]))
+                    hits.record(k);
+            }
+        }
+    }
+
+    virtual bool is_interior(double a, double b, real& tex_u, real& tex_v) const {
         interval unit_interval = interval(0, 1);
         // Given the hit point in plane coordinates, return false if it is outside the
-        // primitive, otherwise set the hit record UV coordinates and return true.
+        // primitive, otherwise set its UV coordinates and return true.
 
         if (!unit_interval.contains(a) || !unit_interval.contains(b))
             return false;
 
-        rec.u = a;
-        rec.v = b;
+        tex_u = a;
+        tex_v = b;
         return true;
     }
 
     double pdf_value(const point3& origin, const vec3& direction) const override {
-        hit_record rec;
-        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+        double t;
+        real alpha, beta, tex_u, tex_v;
+        ray r(origin, direction);
+        if (!locate(r, interval(0, infinity), t, alpha, beta, tex_u, tex_v))
             return 0;
 
-        auto distance_squared = rec.t * rec.t * direction.length_squared();
-        auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+        auto distance_squared = t * t * direction.length_squared();
+        auto cosine = std::fabs(dot(direction, normal) / direction.length());
 
         return distance_squared / (cosine * area);
     }
@@ -105,6 +162,34 @@ class quad : public hittable {
     vec3 normal;
     double D;
     double area;
+
+    bool locate(
+        const ray& r, interval ray_t, double& t, real& alpha, real& beta, real& tex_u,
+        real& tex_v
+    ) const {
+        // Finds where the ray meets the plane, as the distance t and the plane coordinates
+        // alpha and beta, and returns true if that point lies within the shape, whose texture
+        // coordinates is_interior() then sets in tex_u and tex_v.
+
+        auto denom = dot(normal, r.direction());
+
+        // No hit if the ray is parallel to the plane.
+        if (std::fabs(denom) < 1e-8)
+            return false;
+
+        // Return false if the hit point parameter t is outside the ray interval.
+        t = (D - dot(normal, r.origin())) / denom;
+        if (!ray_t.contains(t))
+            return false;
+
+        // Determine if the hit point lies within the planar shape using its plane coordinates.
+        auto intersection = r.at(t);
+        vec3 planar_hitpt_vector = intersection - Q;
+        alpha = dot(w, cross(planar_hitpt_vector, v));
+        beta = dot(w, cross(u, planar_hitpt_vector));
+
+        return is_interior(alpha, beta, tex_u, tex_v);
+    }
 };
 
 
@@ -0,0 +1,64 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "simd.h"
+
+#include <cstdint>
+
+
+constexpr int packet_size = 8;  // Rays per packet, a multiple of every SIMD width
+
+
+class ray_packet {
+  // Up to packet_size rays that are traced together, such as camera rays through the samples
+  // of one pixel. Besides the rays themselves, the packet keeps their components side by
+  // side, one array per component with one lane per ray, so that the bounding box and shape
+  // tests run across the rays at once. Lanes past `count` repeat the last ray and are never
+  // reported as hits.
+  public:
+    void add(const ray& r) {
+        auto k = count++;
+        for (auto lane = k; lane < packet_size; lane++) {
+            rays[lane] = r;
+            for (int axis = 0; axis < 3; axis++) {
+                origin[axis][lane] = r.origin()[axis];
+                direction[axis][lane] = r.direction()[axis];
+                float_origin[axis][lane] = float(r.origin()[axis]);
+                inv_direction[axis][lane] = float(1.0 / r.direction()[axis]);
+            }
+            time[lane] = r.time();
+        }
+    }
+
+    int size() const { return count; }
+
+    uint32_t all_lanes() const { return (1u << count) - 1; }
+
+    ray rays[packet_size];
+
+    double origin[3][packet_size];
+    double direction[3][packet_size];
+    double time[packet_size];
+
+    // For the bounding box tests, which run in single precision
+    float float_origin[3][packet_size];
+    float inv_direction[3][packet_size];
+
+    // If set, the sample sequence of each ray. Shapes that draw random numbers while they're
+    // hit, like volumes, draw them from their ray's sequence.
+    sample_sequence* sequences = nullptr;
+
+  private:
+    int count = 0;
+};
+
+
+#endif
@@ -0,0 +1,138 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Compares camera configurations on the Cornell box from restLife.cc. Each configuration
+// renders the image several times with different seeds, interleaved with the others, and keeps
+// its best time. The mean pixel value and a bias score against the first configuration show
+// whether the images agree; the noise between trials and the render time give the efficiency.
+// The noise is reported both as an RMS difference, which fireflies dominate, and as a mean
+// absolute difference, which follows the noise over most of the image.
+
+#include "rtweekend.h"
+
+#include "bench_scenes.h"
+#include "bvh.h"
+#include "camera.h"
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+struct configuration {
+    const char* name;
+    std::function<void(camera&)> apply;
+    std::vector<color> image = {};   // From the latest trial
+    double best_seconds = infinity;
+    double variance_sum = 0;         // Per-pixel variance estimates from pairs of trials
+    double abs_noise_sum = 0;        // Mean absolute differences between pairs of trials
+    int    variance_count = 0;
+    double rays_per_sample = 0;      // Reported by the iterative integrator
+};
+
+
+double bias_score(const std::vector<color>& a, const std::vector<color>& b) {
+    // Mean per-channel difference between the images in units of its standard error. Two
+    // unbiased renders of the same scene land within a few units of zero.
+
+    double n = 3.0 * a.size();
+    double sum = 0, sum_squares = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        auto d = a[i] - b[i];
+        sum += d.x() + d.y() + d.z();
+        sum_squares += d.length_squared();
+    }
+
+    auto mean = sum / n;
+    auto variance = sum_squares / n - mean * mean;
+    return (variance > 0) ? mean / std::sqrt(variance / n) : 0;
+}
+
+
+int main() {
+    auto scene = cornell_box();
+    hittable_list world(make_shared<linear_bvh>(scene.world));
+    const auto& lights = scene.lights;
+
+    auto& cam = scene.cam;
+    cam.samples_per_pixel = 64;
+    cam.max_depth         = 50;
+
+    cam.sampler = sampler_type::random;  // The baseline of the sampler configurations below
+
+    std::vector<configuration> configurations = {
+        { "recursive", [](camera& c) { c.integrator = path_integrator::recursive; } },
+        { "iterative", [](camera& c) {
+            c.integrator = path_integrator::iterative;
+            c.russian_roulette = false;
+        } },
+        { "roulette", [](camera& c) {
+            c.integrator = path_integrator::iterative;
+            c.russian_roulette = true;
+        } },
+        { "next event", [](camera& c) { c.integrator = path_integrator::next_event; } },
+        { "adaptive", [](camera& c) { c.adaptive_sampling = true; } },
+        { "halton", [](camera& c) { c.sampler = sampler_type::halton; } },
+        { "sobol", [](camera& c) { c.sampler = sampler_type::sobol; } },
+    };
+
+    // Every render uses its own seed. Configurations that trace the same paths would otherwise
+    // render the same samples, and their bias score would measure rounding differences. The
+    // difference between two trials of one configuration measures its noise.
+    for (int trial = 0; trial < 4; trial++) {
+        for (size_t k = 0; k < configurations.size(); k++) {
+            auto& config = configurations[k];
+            camera c = cam;
+            c.seed = uint64_t(trial) * configurations.size() + k;
+            config.apply(c);
+
+            auto start = std::chrono::steady_clock::now();
+            auto image = c.render_pixels(world, lights);
+            auto stop = std::chrono::steady_clock::now();
+
+            auto seconds = std::chrono::duration<double>(stop - start).count();
+            config.best_seconds = std::fmin(config.best_seconds, seconds);
+
+            if (!config.image.empty()) {
+                // The difference of two independent renders has twice the variance of one.
+                auto rms = rms_difference(image, config.image);
+                config.variance_sum += rms * rms / 2;
+                config.abs_noise_sum += mean_abs_difference(image, config.image) / std::sqrt(2);
+                config.variance_count++;
+            }
+            config.image = std::move(image);
+
+            const auto& stats = c.last_statistics();
+            config.rays_per_sample = stats.paths ? double(stats.rays) / stats.paths : 0;
+        }
+    }
+
+    auto samples = double(cam.image_width) * cam.image_width * cam.samples_per_pixel;
+    const auto& reference = configurations[0];
+    auto reference_variance = reference.variance_sum / reference.variance_count;
+
+    // Efficiency is the inverse of variance times render time, relative to the first
+    // configuration: above one means less noise for the same time.
+    for (const auto& config : configurations) {
+        auto variance = config.variance_sum / config.variance_count;
+        auto efficiency = (reference_variance * reference.best_seconds)
+                        / (variance * config.best_seconds);
+
+        std::cout << std::left << std::setw(12) << config.name << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(8) << samples / config.best_seconds / 1e6
+                  << " Msamples/s   rays/sample " << std::setprecision(2)
+                  << config.rays_per_sample << "   mean " << std::setprecision(5)
+                  << mean_value(config.image) << "   noise " << std::sqrt(variance)
+                  << " rms, " << config.abs_noise_sum / config.variance_count << " abs"
+                  << "   efficiency " << std::setprecision(2) << efficiency
+                  << "   bias score " << bias_score(config.image, reference.image) << '\n';
+    }
+}
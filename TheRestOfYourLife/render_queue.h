@@ -0,0 +1,102 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "camera.h"
+#include "hittable.h"
+#include "thread_pool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+class render_queue {
+  // Renders any number of (camera, output file) jobs of one scene on a shared thread pool.
+  // A single driver thread takes the jobs in the order they were submitted and renders each
+  // one on the pool, so a queue costs one extra thread however many jobs it holds. The driver
+  // is not a pool worker, so a worker waiting on its own tiles never picks up and nests a
+  // whole render of another job. Jobs are submitted and waited on from a single thread.
+  public:
+    render_queue(thread_pool& pool, const hittable& world, const hittable& lights)
+      : pool(pool), world(world), lights(lights) {}
+
+    ~render_queue() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        if (driver.joinable())
+            driver.join();
+    }
+
+    render_queue(const render_queue&) = delete;
+    render_queue& operator=(const render_queue&) = delete;
+
+    void submit(const camera& cam, const std::string& filename) {
+        // Queues a render of the scene through a copy of the camera, so the caller may go on
+        // changing its camera for the next job.
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back({cam, filename});
+        }
+        changed.notify_all();
+
+        if (!driver.joinable())
+            driver = std::thread([this] { drive(); });
+    }
+
+    void wait() {
+        // Blocks until every job submitted so far has been written.
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return finished == jobs.size(); });
+    }
+
+  private:
+    struct render_job {
+        camera      cam;
+        std::string filename;
+    };
+
+    thread_pool&            pool;
+    const hittable&         world;
+    const hittable&         lights;
+    std::deque<render_job>  jobs;  // A deque, so queued jobs never move
+    size_t                  finished = 0;  // Jobs written so far, which lead the queue
+    bool                    stopping = false;
+    std::mutex              mutex;
+    std::condition_variable changed;
+    std::thread             driver;
+
+    void drive() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this] { return stopping || finished < jobs.size(); });
+            if (finished == jobs.size())
+                return;
+
+            auto& job = jobs[finished];
+            lock.unlock();
+            job.cam.render(pool, world, lights, job.filename);
+            lock.lock();
+
+            finished++;
+            changed.notify_all();
+        }
+    }
+};
+
+
+#endif
@@ -11,6 +11,7 @@
 
 #include "rtweekend.h"
 
+#include "bvh.h"
 #include "camera.h"
 #include "hittable_list.h"
 #include "material.h"
@@ -46,6 +47,10 @@ int main() {
     auto glass = make_shared<dielectric>(1.5);
     world.add(make_shared<sphere>(point3(190,90,190), 90, glass));
 
+    auto accel = make_shared<linear_bvh>(world);
+    std::clog << "BVH built in " << accel->stats().build_seconds << " s\n";
+    world = hittable_list(accel);
+
     // Light Sources
     auto empty_material = shared_ptr<material>();
     hittable_list lights;
@@ -68,5 +73,5 @@ int main() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world, lights);
+    cam.render(world, lights, "restLife.ppm");
 }
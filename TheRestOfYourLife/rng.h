@@ -0,0 +1,62 @@
+#ifndef RNG_H
+#define RNG_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <cstdint>
+
+
+class pcg32 {
+  // Permuted congruential generator (PCG-XSH-RR, O'Neill 2014): 64 bits of state, 32 bits of
+  // output per step. Each (seed, stream) pair selects an independent sequence.
+  public:
+    pcg32() { seed(default_state, default_stream); }
+
+    pcg32(uint64_t initstate, uint64_t initseq = default_stream) { seed(initstate, initseq); }
+
+    void seed(uint64_t initstate, uint64_t initseq = default_stream) {
+        state = 0;
+        inc = (initseq << 1u) | 1u;
+        next_uint();
+        state += initstate;
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        uint64_t old = state;
+        state = old * multiplier + inc;
+        auto xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+        auto rot = uint32_t(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+
+    double next_double() {
+        // Returns a random real in [0,1).
+        return next_uint() * (1.0 / 4294967296.0);
+    }
+
+  private:
+    static constexpr uint64_t multiplier     = 0x5851f42d4c957f2dULL;
+    static constexpr uint64_t default_state  = 0x853c49e6748fea9bULL;
+    static constexpr uint64_t default_stream = 0xda3e39cb94b95bdbULL;
+
+    uint64_t state;
+    uint64_t inc;
+};
+
+
+inline uint64_t mix_bits(uint64_t x) {
+    // The SplitMix64 finalizer: scrambles x so that nearby inputs give unrelated outputs.
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+
+#endif
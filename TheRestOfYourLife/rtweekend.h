@@ -14,6 +14,10 @@
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <sstream>
+
+#include "sampler.h"
 
 
 // C++ Std Usings
@@ -22,6 +26,16 @@ using std::make_shared;
 using std::shared_ptr;
 
 
+// Scalar type of the geometry: vectors, points, colors, rays, intervals and bounding boxes.
+// Build with -DRTW_FLOAT to trace in single precision.
+
+#if defined(RTW_FLOAT)
+using real = float;
+#else
+using real = double;
+#endif
+
+
 // Constants
 
 const double infinity = std::numeric_limits<double>::infinity();
@@ -35,8 +49,8 @@ inline double degrees_to_radians(double degrees) {
 }
 
 inline double random_double() {
-    // Returns a random real in [0,1).
-    return std::rand() / (RAND_MAX + 1.0);
+    // Returns a random real in [0,1): the next dimension of the calling thread's sample.
+    return thread_sampler().next_1d();
 }
 
 inline double random_double(double min, double max) {
@@ -44,6 +58,21 @@ inline double random_double(double min, double max) {
     return min + (max-min)*random_double();
 }
 
+inline std::mutex& log_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+template <typename... Args>
+void log_line(std::ostream& out, const Args&... args) {
+    // Writes the arguments to out as a single message, under one lock for the whole program,
+    // so that the messages of renders running side by side never interleave.
+    std::ostringstream message;
+    (message << ... << args);
+    std::lock_guard<std::mutex> lock(log_mutex());
+    out << message.str() << std::flush;
+}
+
 inline int random_int(int min, int max) {
     // Returns a random integer in [min,max].
     return int(random_double(min, max+1));
@@ -0,0 +1,178 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rng.h"
+
+#include <cstdint>
+#include <utility>
+
+
+enum class sampler_type {
+    random,  // Independent numbers from a pcg32 stream per sample
+    halton,  // Halton sequence, one prime base per dimension, rotated per pixel
+    sobol    // Owen-scrambled Sobol points, in an order shuffled per pixel and dimension
+};
+
+
+class sample_sequence {
+  // The numbers of one pixel sample, handed out one dimension after another. While a sample
+  // is traced, random_double() draws from the calling thread's sequence, so the camera, the
+  // materials, the pdfs and the lights all take their numbers from the sampler without one
+  // being passed around. A sequence holds all of its state, its pcg32 included, so a sample
+  // can be put aside and continued later by copying the sequence out and back in.
+  //
+  // For the low discrepancy samplers, every dimension of a pixel is its own well spread
+  // sequence over the sample index. Paths that take different numbers of dimensions only
+  // shift later dimensions to other, equally well spread sequences, so the estimate stays
+  // unbiased. Past the first low_discrepancy_dimensions, which cover the camera and the first
+  // bounces where nearly all of the gain is, the sample continues with its pcg32 sequence,
+  // which costs a fraction of a scrambled point.
+  public:
+    void start(sampler_type type, uint64_t seed, uint64_t pixel, uint64_t sample) {
+        // Begins the given sample of the given pixel at its first dimension.
+
+        this->type = type;
+        this->sample = sample;
+        reversed_sample = reverse_bits(uint32_t(sample));
+        dimension = 0;
+        pixel_seed = mix_bits(seed ^ mix_bits(pixel + 0x9e3779b97f4a7c15ULL));
+
+        // The random dimensions are the successive numbers of the sample's own pcg32 stream,
+        // so each one is fixed by (seed, pixel, sample, dimension), whichever thread or tile
+        // takes the sample.
+        generator.seed(mix_bits(seed ^ mix_bits(sample)), pixel);
+    }
+
+    double next_1d() {
+        // Returns the number of the next dimension, in [0,1).
+
+        if (type == sampler_type::random || dimension >= low_discrepancy_dimensions)
+            return generator.next_double();
+
+        auto d = dimension++;
+        return (type == sampler_type::sobol) ? sobol_1d(d) : halton(d);
+    }
+
+    std::pair<double, double> next_2d() {
+        // Returns the numbers of the next two dimensions. Sobol points are stratified over the
+        // pair jointly, not just along each of the two axes.
+
+        if (type == sampler_type::sobol && dimension + 2 <= low_discrepancy_dimensions) {
+            auto point = sobol_2d(dimension);
+            dimension += 2;
+            return point;
+        }
+
+        auto u = next_1d();
+        auto v = next_1d();
+        return {u, v};
+    }
+
+  private:
+    sampler_type type   = sampler_type::random;
+    uint64_t pixel_seed = 0;
+    uint64_t sample     = 0;
+    uint32_t reversed_sample = 0;  // The sample index with its bits in reverse order
+    uint32_t dimension  = 0;
+    pcg32    generator;
+
+    static constexpr uint32_t low_discrepancy_dimensions = 16;
+    static constexpr uint32_t primes[low_discrepancy_dimensions] = {
+        2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53
+    };
+
+    uint64_t dimension_hash(uint32_t d) const {
+        // Returns 64 random bits for dimension d of this pixel, enough for two 32-bit seeds.
+        return mix_bits(pixel_seed + (uint64_t(d) + 1) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    static double to_unit(uint32_t bits) {
+        return bits * (1.0 / 4294967296.0);
+    }
+
+    static uint32_t reverse_bits(uint32_t x) {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    static uint32_t laine_karras(uint32_t x, uint32_t seed) {
+        // A hash that scrambles every bit of x depending only on the bits below it. On bit
+        // reversed numbers this is a nested uniform (Owen) scramble (Burley 2020): it
+        // randomly permutes the binary digits, each depending only on the digits above it.
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    static uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+        return reverse_bits(laine_karras(reverse_bits(x), seed));
+    }
+
+    static uint32_t sobol_second(uint32_t index) {
+        // The second dimension of the Sobol sequence, as a 32-bit binary fraction.
+
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+            if (index & 1)
+                result ^= v;
+        return result;
+    }
+
+    double sobol_1d(uint32_t d) const {
+        // The first Sobol dimension of the shuffled index, Owen scrambled. The first
+        // dimension is the index with its bits reversed, so the shuffle's own bit reversals
+        // cancel out.
+
+        auto hash = dimension_hash(d);
+        auto point = laine_karras(reversed_sample, uint32_t(hash));
+        return to_unit(owen_scramble(point, uint32_t(hash >> 32)));
+    }
+
+    std::pair<double, double> sobol_2d(uint32_t d) const {
+        auto hash = dimension_hash(d);
+        auto point = laine_karras(reversed_sample, uint32_t(hash));
+        auto u = owen_scramble(point, uint32_t(hash >> 32));
+        auto v = owen_scramble(sobol_second(reverse_bits(point)), uint32_t(mix_bits(hash)));
+        return {to_unit(u), to_unit(v)};
+    }
+
+    double halton(uint32_t d) const {
+        // The radical inverse of the sample index in the dimension's prime base, rotated by
+        // a per-pixel offset.
+
+        auto base = primes[d];
+        double inverse_base = 1.0 / base;
+        double scale = inverse_base;
+        double result = 0;
+        for (auto index = sample; index != 0; index /= base) {
+            result += double(index % base) * scale;
+            scale *= inverse_base;
+        }
+
+        result += to_unit(uint32_t(dimension_hash(d)));
+        return (result >= 1) ? result - 1 : result;
+    }
+};
+
+
+inline sample_sequence& thread_sampler() {
+    static thread_local sample_sequence sequence;
+    return sequence;
+}
+
+
+#endif
@@ -0,0 +1,74 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Counts heap allocations made while rendering the Cornell box. Two renders that differ only
+// in samples per pixel share the same fixed setup cost (buffers, threads, tile tasks), so the
+// difference between them divided by the extra samples is the per-sample allocation count.
+
+#include "rtweekend.h"
+
+#include "bench_scenes.h"
+#include "camera.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+
+// Replaces the plain and array forms of new and delete, with and without sizes, as one set,
+// so every allocation and release goes through the same std::malloc and std::free pair.
+
+static std::atomic<long long> allocation_count{0};
+
+static void* counted_allocation(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size) { return counted_allocation(size); }
+void* operator new[](std::size_t size) { return counted_allocation(size); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+
+long long count_render_allocations(camera& cam, const hittable& world, const hittable& lights) {
+    auto before = allocation_count.load();
+    cam.render(world, lights, "scatter_allocs.ppm");
+    return allocation_count.load() - before;
+}
+
+
+int main() {
+    auto scene = cornell_box();
+    const auto& world = scene.world;
+    const auto& lights = scene.lights;
+
+    auto& cam = scene.cam;
+    cam.image_width = 64;
+    cam.max_depth   = 50;
+
+    cam.samples_per_pixel = 1;
+    auto base = count_render_allocations(cam, world, lights);
+
+    cam.samples_per_pixel = 16;
+    auto full = count_render_allocations(cam, world, lights);
+
+    auto extra_samples = double(cam.image_width) * cam.image_width * (16 - 1);
+
+    std::cout
+        << "Allocations, 1 spp render:  " << base << '\n'
+        << "Allocations, 16 spp render: " << full << '\n'
+        << "Allocations per sample:     " << (full - base) / extra_samples << '\n';
+}
@@ -0,0 +1,365 @@
+#ifndef SIMD_H
+#define SIMD_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Thin wrappers over the widest vector registers the compiler targets: AVX when it's enabled
+// (for example with -mavx2 or -march=native), otherwise SSE2, which every x86-64 processor
+// has, and plain scalars anywhere else. Code written against them loops over its lanes in
+// steps of `width` and compiles to whichever of the three the build selects.
+//
+// Every operation rounds exactly like the scalar expression it replaces, so a vectorized test
+// gives the same answers as the single-ray code it stands in for, unless that code rounds
+// differently itself (see filter_tolerance below).
+//
+// vfloat4 and vdouble4 always have four lanes, for data that comes in fours whatever the
+// register width, like the children of a wide BVH node or a vec3 padded to four components.
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__AVX__)
+    #define RTW_SIMD_AVX
+    #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define RTW_SIMD_SSE2
+    #include <emmintrin.h>
+#endif
+
+
+// Vector code is never contracted into fused multiply-adds, but scalar code may be, and with
+// -DRTW_FLOAT the scalar tests run in single precision while the vector filters stay in double.
+// In those builds a filter that picks out lanes for a scalar test to complete widens its bounds
+// by this relative tolerance, so it never drops a lane the scalar test would accept.
+
+#if defined(RTW_FLOAT)
+constexpr double filter_tolerance = 8 * double(std::numeric_limits<float>::epsilon());
+#elif defined(__FMA__) || defined(__FP_FAST_FMA)
+constexpr double filter_tolerance = 8 * std::numeric_limits<double>::epsilon();
+#else
+constexpr double filter_tolerance = 0;
+#endif
+
+
+struct vfloat {
+  #if defined(RTW_SIMD_AVX)
+    static constexpr int width = 8;
+    __m256 v;
+
+    static vfloat load(const float* p) { return {_mm256_loadu_ps(p)}; }
+    static vfloat broadcast(float x)   { return {_mm256_set1_ps(x)}; }
+
+    friend vfloat operator-(vfloat a, vfloat b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    friend vfloat operator*(vfloat a, vfloat b) { return {_mm256_mul_ps(a.v, b.v)}; }
+
+    // a > b ? a : b and a < b ? a : b, lane by lane, so a NaN in a yields b.
+    friend vfloat max(vfloat a, vfloat b) { return {_mm256_max_ps(a.v, b.v)}; }
+    friend vfloat min(vfloat a, vfloat b) { return {_mm256_min_ps(a.v, b.v)}; }
+
+    friend vfloat select_negative(vfloat x, vfloat if_negative, vfloat otherwise) {
+        // Lanes of if_negative where x < 0, lanes of otherwise elsewhere.
+        auto negative = _mm256_cmp_ps(x.v, _mm256_setzero_ps(), _CMP_LT_OQ);
+        return {_mm256_blendv_ps(otherwise.v, if_negative.v, negative)};
+    }
+
+    friend uint32_t less_equal_mask(vfloat a, vfloat b) {
+        // Bit k is set where lane k of a <= lane k of b.
+        return uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)));
+    }
+  #elif defined(RTW_SIMD_SSE2)
+    static constexpr int width = 4;
+    __m128 v;
+
+    static vfloat load(const float* p) { return {_mm_loadu_ps(p)}; }
+    static vfloat broadcast(float x)   { return {_mm_set1_ps(x)}; }
+
+    friend vfloat operator-(vfloat a, vfloat b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend vfloat operator*(vfloat a, vfloat b) { return {_mm_mul_ps(a.v, b.v)}; }
+
+    friend vfloat max(vfloat a, vfloat b) { return {_mm_max_ps(a.v, b.v)}; }
+    friend vfloat min(vfloat a, vfloat b) { return {_mm_min_ps(a.v, b.v)}; }
+
+    friend vfloat select_negative(vfloat x, vfloat if_negative, vfloat otherwise) {
+        auto negative = _mm_cmplt_ps(x.v, _mm_setzero_ps());
+        return {_mm_or_ps(_mm_and_ps(negative, if_negative.v),
+                          _mm_andnot_ps(negative, otherwise.v))};
+    }
+
+    friend uint32_t less_equal_mask(vfloat a, vfloat b) {
+        return uint32_t(_mm_movemask_ps(_mm_cmple_ps(a.v, b.v)));
+    }
+  #else
+    static constexpr int width = 1;
+    float v;
+
+    static vfloat load(const float* p) { return {*p}; }
+    static vfloat broadcast(float x)   { return {x}; }
+
+    friend vfloat operator-(vfloat a, vfloat b) { return {a.v - b.v}; }
+    friend vfloat operator*(vfloat a, vfloat b) { return {a.v * b.v}; }
+
+    friend vfloat max(vfloat a, vfloat b) { return {a.v > b.v ? a.v : b.v}; }
+    friend vfloat min(vfloat a, vfloat b) { return {a.v < b.v ? a.v : b.v}; }
+
+    friend vfloat select_negative(vfloat x, vfloat if_negative, vfloat otherwise) {
+        return {x.v < 0 ? if_negative.v : otherwise.v};
+    }
+
+    friend uint32_t less_equal_mask(vfloat a, vfloat b) { return a.v <= b.v ? 1u : 0u; }
+  #endif
+};
+
+
+struct vfloat4 {
+  #if defined(RTW_SIMD_AVX) || defined(RTW_SIMD_SSE2)
+    __m128 v;
+
+    static vfloat4 load(const float* p) { return {_mm_loadu_ps(p)}; }
+    static vfloat4 broadcast(float x)   { return {_mm_set1_ps(x)}; }
+    void store(float* p) const          { _mm_storeu_ps(p, v); }
+
+    friend vfloat4 operator+(vfloat4 a, vfloat4 b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend vfloat4 operator-(vfloat4 a, vfloat4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend vfloat4 operator*(vfloat4 a, vfloat4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+    friend vfloat4 operator/(vfloat4 a, vfloat4 b) { return {_mm_div_ps(a.v, b.v)}; }
+
+    // Lanes 1, 2, 0, 3 of a: the y, z, x rotation of a padded three-component vector.
+    friend vfloat4 rotate3(vfloat4 a) {
+        return {_mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3,0,2,1))};
+    }
+
+    friend float sum3(vfloat4 a) {
+        // (a0 + a1) + a2, in the order a scalar sum of three components adds them.
+        float x = _mm_cvtss_f32(a.v);
+        float y = _mm_cvtss_f32(_mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1,1,1,1)));
+        float z = _mm_cvtss_f32(_mm_movehl_ps(a.v, a.v));
+        return (x + y) + z;
+    }
+
+    // As for vfloat, a NaN in a yields b.
+    friend vfloat4 max(vfloat4 a, vfloat4 b) { return {_mm_max_ps(a.v, b.v)}; }
+    friend vfloat4 min(vfloat4 a, vfloat4 b) { return {_mm_min_ps(a.v, b.v)}; }
+
+    friend uint32_t less_equal_mask(vfloat4 a, vfloat4 b) {
+        return uint32_t(_mm_movemask_ps(_mm_cmple_ps(a.v, b.v)));
+    }
+  #else
+    float v[4];
+
+    static vfloat4 load(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+    static vfloat4 broadcast(float x)   { return {{x, x, x, x}}; }
+    void store(float* p) const          { for (int k = 0; k < 4; k++) p[k] = v[k]; }
+
+    friend vfloat4 operator+(vfloat4 a, vfloat4 b) {
+        return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+    }
+    friend vfloat4 operator-(vfloat4 a, vfloat4 b) {
+        return {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+    }
+    friend vfloat4 operator*(vfloat4 a, vfloat4 b) {
+        return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}};
+    }
+    friend vfloat4 operator/(vfloat4 a, vfloat4 b) {
+        return {{a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]}};
+    }
+
+    friend vfloat4 rotate3(vfloat4 a) { return {{a.v[1], a.v[2], a.v[0], a.v[3]}}; }
+    friend float sum3(vfloat4 a)      { return (a.v[0] + a.v[1]) + a.v[2]; }
+
+    friend vfloat4 max(vfloat4 a, vfloat4 b) {
+        vfloat4 result;
+        for (int k = 0; k < 4; k++) result.v[k] = a.v[k] > b.v[k] ? a.v[k] : b.v[k];
+        return result;
+    }
+    friend vfloat4 min(vfloat4 a, vfloat4 b) {
+        vfloat4 result;
+        for (int k = 0; k < 4; k++) result.v[k] = a.v[k] < b.v[k] ? a.v[k] : b.v[k];
+        return result;
+    }
+
+    friend uint32_t less_equal_mask(vfloat4 a, vfloat4 b) {
+        uint32_t mask = 0;
+        for (int k = 0; k < 4; k++) mask |= (a.v[k] <= b.v[k] ? 1u : 0u) << k;
+        return mask;
+    }
+  #endif
+};
+
+
+struct vdouble4 {
+  #if defined(__AVX2__)
+    __m256d v;
+
+    static vdouble4 load(const double* p) { return {_mm256_loadu_pd(p)}; }
+    static vdouble4 broadcast(double x)   { return {_mm256_set1_pd(x)}; }
+    void store(double* p) const           { _mm256_storeu_pd(p, v); }
+
+    friend vdouble4 operator+(vdouble4 a, vdouble4 b) { return {_mm256_add_pd(a.v, b.v)}; }
+    friend vdouble4 operator-(vdouble4 a, vdouble4 b) { return {_mm256_sub_pd(a.v, b.v)}; }
+    friend vdouble4 operator*(vdouble4 a, vdouble4 b) { return {_mm256_mul_pd(a.v, b.v)}; }
+    friend vdouble4 operator/(vdouble4 a, vdouble4 b) { return {_mm256_div_pd(a.v, b.v)}; }
+
+    friend vdouble4 rotate3(vdouble4 a) {
+        return {_mm256_permute4x64_pd(a.v, _MM_SHUFFLE(3,0,2,1))};
+    }
+
+    friend double sum3(vdouble4 a) {
+        auto low = _mm256_castpd256_pd128(a.v);
+        auto x = _mm_cvtsd_f64(low);
+        auto y = _mm_cvtsd_f64(_mm_unpackhi_pd(low, low));
+        auto z = _mm_cvtsd_f64(_mm256_extractf128_pd(a.v, 1));
+        return (x + y) + z;
+    }
+  #elif defined(RTW_SIMD_AVX) || defined(RTW_SIMD_SSE2)
+    // Without AVX2 there's no single instruction for rotate3 on a 256-bit register, so the
+    // lanes are kept in two SSE2 registers: 0 and 1 in lo, 2 and 3 in hi.
+    __m128d lo, hi;
+
+    static vdouble4 load(const double* p) { return {_mm_loadu_pd(p), _mm_loadu_pd(p + 2)}; }
+    static vdouble4 broadcast(double x)   { return {_mm_set1_pd(x), _mm_set1_pd(x)}; }
+    void store(double* p) const           { _mm_storeu_pd(p, lo); _mm_storeu_pd(p + 2, hi); }
+
+    friend vdouble4 operator+(vdouble4 a, vdouble4 b) {
+        return {_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)};
+    }
+    friend vdouble4 operator-(vdouble4 a, vdouble4 b) {
+        return {_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)};
+    }
+    friend vdouble4 operator*(vdouble4 a, vdouble4 b) {
+        return {_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)};
+    }
+    friend vdouble4 operator/(vdouble4 a, vdouble4 b) {
+        return {_mm_div_pd(a.lo, b.lo), _mm_div_pd(a.hi, b.hi)};
+    }
+
+    friend vdouble4 rotate3(vdouble4 a) {
+        return {_mm_shuffle_pd(a.lo, a.hi, 1), _mm_shuffle_pd(a.lo, a.hi, 2)};
+    }
+
+    friend double sum3(vdouble4 a) {
+        auto x = _mm_cvtsd_f64(a.lo);
+        auto y = _mm_cvtsd_f64(_mm_unpackhi_pd(a.lo, a.lo));
+        auto z = _mm_cvtsd_f64(a.hi);
+        return (x + y) + z;
+    }
+  #else
+    double v[4];
+
+    static vdouble4 load(const double* p) { return {{p[0], p[1], p[2], p[3]}}; }
+    static vdouble4 broadcast(double x)   { return {{x, x, x, x}}; }
+    void store(double* p) const           { for (int k = 0; k < 4; k++) p[k] = v[k]; }
+
+    friend vdouble4 operator+(vdouble4 a, vdouble4 b) {
+        return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+    }
+    friend vdouble4 operator-(vdouble4 a, vdouble4 b) {
+        return {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+    }
+    friend vdouble4 operator*(vdouble4 a, vdouble4 b) {
+        return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}};
+    }
+    friend vdouble4 operator/(vdouble4 a, vdouble4 b) {
+        return {{a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]}};
+    }
+
+    friend vdouble4 rotate3(vdouble4 a) { return {{a.v[1], a.v[2], a.v[0], a.v[3]}}; }
+    friend double sum3(vdouble4 a)      { return (a.v[0] + a.v[1]) + a.v[2]; }
+  #endif
+};
+
+
+inline float reciprocal_sqrt(float x) {
+    // 1/sqrt(x) from the hardware estimate, good to 12 bits, refined by a Newton-Raphson
+    // step to within a few units in the last place.
+  #if defined(RTW_SIMD_AVX) || defined(RTW_SIMD_SSE2)
+    float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return y * (1.5f - 0.5f * x * y * y);
+  #else
+    return 1 / std::sqrt(x);
+  #endif
+}
+
+
+inline double reciprocal_sqrt(double x) {
+    // Refining the single precision estimate to double precision takes as long as the exact
+    // square root and division do, so this is the exact route.
+    return 1 / std::sqrt(x);
+}
+
+
+struct vdouble {
+  #if defined(RTW_SIMD_AVX)
+    static constexpr int width = 4;
+    __m256d v;
+
+    static vdouble load(const double* p) { return {_mm256_loadu_pd(p)}; }
+    static vdouble broadcast(double x)   { return {_mm256_set1_pd(x)}; }
+    void store(double* p) const          { _mm256_storeu_pd(p, v); }
+
+    friend vdouble operator+(vdouble a, vdouble b) { return {_mm256_add_pd(a.v, b.v)}; }
+    friend vdouble operator-(vdouble a, vdouble b) { return {_mm256_sub_pd(a.v, b.v)}; }
+    friend vdouble operator*(vdouble a, vdouble b) { return {_mm256_mul_pd(a.v, b.v)}; }
+    friend vdouble operator/(vdouble a, vdouble b) { return {_mm256_div_pd(a.v, b.v)}; }
+
+    friend vdouble sqrt(vdouble a) { return {_mm256_sqrt_pd(a.v)}; }
+    friend vdouble abs(vdouble a)  { return {_mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v)}; }
+
+    // Masks of the lanes where the comparison holds, bit k for lane k.
+    friend uint32_t less_mask(vdouble a, vdouble b) {
+        return uint32_t(_mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)));
+    }
+    friend uint32_t less_equal_mask(vdouble a, vdouble b) {
+        return uint32_t(_mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)));
+    }
+  #elif defined(RTW_SIMD_SSE2)
+    static constexpr int width = 2;
+    __m128d v;
+
+    static vdouble load(const double* p) { return {_mm_loadu_pd(p)}; }
+    static vdouble broadcast(double x)   { return {_mm_set1_pd(x)}; }
+    void store(double* p) const          { _mm_storeu_pd(p, v); }
+
+    friend vdouble operator+(vdouble a, vdouble b) { return {_mm_add_pd(a.v, b.v)}; }
+    friend vdouble operator-(vdouble a, vdouble b) { return {_mm_sub_pd(a.v, b.v)}; }
+    friend vdouble operator*(vdouble a, vdouble b) { return {_mm_mul_pd(a.v, b.v)}; }
+    friend vdouble operator/(vdouble a, vdouble b) { return {_mm_div_pd(a.v, b.v)}; }
+
+    friend vdouble sqrt(vdouble a) { return {_mm_sqrt_pd(a.v)}; }
+    friend vdouble abs(vdouble a)  { return {_mm_andnot_pd(_mm_set1_pd(-0.0), a.v)}; }
+
+    friend uint32_t less_mask(vdouble a, vdouble b) {
+        return uint32_t(_mm_movemask_pd(_mm_cmplt_pd(a.v, b.v)));
+    }
+    friend uint32_t less_equal_mask(vdouble a, vdouble b) {
+        return uint32_t(_mm_movemask_pd(_mm_cmple_pd(a.v, b.v)));
+    }
+  #else
+    static constexpr int width = 1;
+    double v;
+
+    static vdouble load(const double* p) { return {*p}; }
+    static vdouble broadcast(double x)   { return {x}; }
+    void store(double* p) const          { *p = v; }
+
+    friend vdouble operator+(vdouble a, vdouble b) { return {a.v + b.v}; }
+    friend vdouble operator-(vdouble a, vdouble b) { return {a.v - b.v}; }
+    friend vdouble operator*(vdouble a, vdouble b) { return {a.v * b.v}; }
+    friend vdouble operator/(vdouble a, vdouble b) { return {a.v / b.v}; }
+
+    friend vdouble sqrt(vdouble a) { return {std::sqrt(a.v)}; }
+    friend vdouble abs(vdouble a)  { return {std::fabs(a.v)}; }
+
+    friend uint32_t less_mask(vdouble a, vdouble b)       { return a.v < b.v ? 1u : 0u; }
+    friend uint32_t less_equal_mask(vdouble a, vdouble b) { return a.v <= b.v ? 1u : 0u; }
+  #endif
+};
+
+
+#endif
@@ -11,12 +11,14 @@
 
 #include "rtweekend.h"
 
+#include "bvh.h"
 #include "camera.h"
 #include "hittable.h"
 #include "hittable_list.h"
 #include "material.h"
 #include "sphere.h"
 #include "quad.h"
+#include "render_queue.h"
 
 int main() {
     hittable_list world;
@@ -57,6 +59,12 @@ int main() {
     
 
 
+    world = hittable_list(make_shared<linear_bvh>(world));
+
+    // All six views render in turn on one pool, from a single queue thread.
+    thread_pool pool;
+    render_queue jobs(pool, world, lights);
+
     camera cam;
 
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -71,10 +79,10 @@ int main() {
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 15.0;
 
-    cam.render(world, lights, "snowman1.ppm");
+    jobs.submit(cam, "snowman1.ppm");
 
     cam.samples_per_pixel = 30;
-    cam.render(world, lights, "snowman1-1.ppm");
+    jobs.submit(cam, "snowman1-1.ppm");
     //===========================================================\\ 
     
     cam.vfov     = 50;
@@ -84,7 +92,7 @@ int main() {
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 10.0;
 
-    cam.render(world, lights, "snowman2.ppm");
+    jobs.submit(cam, "snowman2.ppm");
 
     //===========================================================\\ 
 
@@ -94,7 +102,7 @@ int main() {
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 10.0;
 
-    cam.render(world, lights, "snowman3.ppm");
+    jobs.submit(cam, "snowman3.ppm");
 
     //===========================================================\\ 
 
@@ -105,7 +113,7 @@ int main() {
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 8.0;
 
-    cam.render(world, lights, "snowman4.ppm");
+    jobs.submit(cam, "snowman4.ppm");
 
     //===========================================================\\ 
 
@@ -116,5 +124,5 @@ int main() {
     cam.defocus_angle = 0.8;
     cam.focus_dist    = 3.0;
 
-    cam.render(world, lights, "snowman5.ppm");
+    jobs.submit(cam, "snowman5.ppm");
 }
@@ -38,42 +38,85 @@ class sphere : public hittable {
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
         point3 current_center = center.at(r.time());
-        vec3 oc = current_center - r.origin();
-        auto a = r.direction().length_squared();
-        auto h = dot(r.direction(), oc);
-        auto c = oc.length_squared() - radius*radius;
-
-        auto discriminant = h*h - a*c;
-        if (discriminant < 0)
+        double root;
+        if (!nearest_root(r, current_center, radius, ray_t, root))
             return false;
 
-        auto sqrtd = std::sqrt(discriminant);
-
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (h - sqrtd) / a;
-        if (!ray_t.surrounds(root)) {
-            root = (h + sqrtd) / a;
-            if (!ray_t.surrounds(root))
-                return false;
-        }
-
         rec.t = root;
-        rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - current_center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
+        set_surface_point(r, current_center, radius, rec);
+        rec.mat = mat.get();
 
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        double root;
+        return nearest_root(r, center.at(r.time()), radius, ray_t, root);
+    }
+
+    void hit_packet(
+        const ray_packet& packet, uint32_t lanes, packet_hits& hits
+    ) const override {
+        // Solves the quadratic of hit() for all the rays side by side, and completes the hits
+        // of the rays with a root in their range with hit() itself. Both compute the roots the
+        // same way, so the rays picked out are exactly the ones that hit() accepts, or a few
+        // more where hit() rounds differently.
+
+        auto center_x = vdouble::broadcast(center.origin().x());
+        auto center_y = vdouble::broadcast(center.origin().y());
+        auto center_z = vdouble::broadcast(center.origin().z());
+        auto motion_x = vdouble::broadcast(center.direction().x());
+        auto motion_y = vdouble::broadcast(center.direction().y());
+        auto motion_z = vdouble::broadcast(center.direction().z());
+        auto radius_squared = vdouble::broadcast(radius*radius);
+        auto t_min = vdouble::broadcast(hits.t_min);
+
+        uint32_t candidates = 0;
+        for (int k = 0; k < packet_size; k += vdouble::width) {
+            constexpr uint32_t chunk = (1u << vdouble::width) - 1;
+            if (!((lanes >> k) & chunk))
+                continue;
+
+            auto time = vdouble::load(packet.time + k);
+            auto dir_x = vdouble::load(packet.direction[0] + k);
+            auto dir_y = vdouble::load(packet.direction[1] + k);
+            auto dir_z = vdouble::load(packet.direction[2] + k);
+            auto orig_x = vdouble::load(packet.origin[0] + k);
+            auto orig_y = vdouble::load(packet.origin[1] + k);
+            auto orig_z = vdouble::load(packet.origin[2] + k);
+            auto current_x = center_x + time * motion_x;
+            auto current_y = center_y + time * motion_y;
+            auto current_z = center_z + time * motion_z;
+            auto oc_x = current_x - orig_x;
+            auto oc_y = current_y - orig_y;
+            auto oc_z = current_z - orig_z;
+
+            auto a = dir_x*dir_x + dir_y*dir_y + dir_z*dir_z;
+            auto h = dir_x*oc_x + dir_y*oc_y + dir_z*oc_z;
+            auto oc_squared = oc_x*oc_x + oc_y*oc_y + oc_z*oc_z;
+            auto extent = abs(current_x) + abs(current_y) + abs(current_z)
+                        + abs(orig_x) + abs(orig_y) + abs(orig_z);
+            auto t_max = vdouble::load(hits.t_max + k);
+
+            candidates |= root_in_range_mask(a, h, oc_squared, radius_squared, extent, t_min,
+                                             t_max) << k;
+        }
+
+        candidates &= lanes;
+        for (int k = 0; k < packet.size(); k++) {
+            if (candidates & (1u << k)) {
+                if (hit(packet.rays[k], interval(hits.t_min, hits.t_max[k]), hits.recs[k]))
+                    hits.record(k);
+            }
+        }
+    }
+
     aabb bounding_box() const override { return bbox; }
 
     double pdf_value(const point3& origin, const vec3& direction) const override {
         // This method only works for stationary spheres.
 
-        hit_record rec;
-        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+        if (!occluded(ray(origin, direction), interval(0, infinity)))
             return 0;
 
         auto dist_squared = (center.at(0) - origin).length_squared();
@@ -87,16 +130,101 @@ class sphere : public hittable {
         vec3 direction = center.at(0) - origin;
         auto distance_squared = direction.length_squared();
         onb uvw(direction);
-        return uvw.transform(random_to_sphere(radius, distance_squared));
+        auto to_sphere = uvw.transform(random_to_sphere(radius, distance_squared));
+
+        // Stretch the direction to reach the near side of the sphere.
+        double root;
+        if (nearest_root(ray(origin, to_sphere), center.at(0), radius, interval(0, infinity),
+                         root))
+            to_sphere *= root;
+        return to_sphere;
     }
 
   private:
+    friend class sphere_block;
+
     ray center;
     double radius;
     shared_ptr<material> mat;
     aabb bbox;
 
-    static void get_sphere_uv(const point3& p, double& u, double& v) {
+    static bool nearest_root(
+        const ray& r, const point3& current_center, double radius, interval ray_t, double& root
+    ) {
+        // Finds the nearest root of the ray's quadratic that lies in the acceptable range.
+
+        vec3 oc = current_center - r.origin();
+        auto a = r.direction().length_squared();
+        auto h = dot(r.direction(), oc);
+        auto c = oc.length_squared() - radius*radius;
+
+        auto discriminant = h*h - a*c;
+        if (discriminant < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+
+        root = (h - sqrtd) / a;
+        if (!ray_t.surrounds(root)) {
+            root = (h + sqrtd) / a;
+            if (!ray_t.surrounds(root))
+                return false;
+        }
+        return true;
+    }
+
+    static uint32_t root_in_range_mask(
+        vdouble a, vdouble h, vdouble oc_squared, vdouble radius_squared, vdouble extent,
+        vdouble t_min, vdouble t_max
+    ) {
+        // Lanes where the quadratic of hit() has a root in (t_min, t_max), solved as hit()
+        // solves it. Where hit() may round differently (see filter_tolerance), the test is
+        // widened by the error hit() can make, which grows with `extent`, the total magnitude
+        // of the coordinates of the sphere's center and the ray's origin.
+
+        auto zero = vdouble::broadcast(0);
+        auto discriminant = h*h - a*(oc_squared - radius_squared);
+        auto in_range = [&](vdouble root, vdouble slack) {
+            return less_mask(t_min - slack, root) & less_mask(root, t_max + slack);
+        };
+
+        if constexpr (filter_tolerance == 0) {
+            auto real = less_equal_mask(zero, discriminant);
+            if (!real)
+                return 0;  // Most rays miss most spheres; skip the roots
+
+            auto sqrtd = sqrt(discriminant);
+            return real & (in_range((h - sqrtd) / a, zero) | in_range((h + sqrtd) / a, zero));
+        } else {
+            auto tolerance = vdouble::broadcast(filter_tolerance);
+            auto slack = tolerance * (h*h + a*(oc_squared + radius_squared + extent*extent));
+            auto real = less_equal_mask(zero, discriminant + slack);
+            if (!real)
+                return 0;
+
+            auto sqrtd = sqrt(abs(discriminant));
+            auto root_slack = (sqrt(slack) + tolerance * (abs(h) + sqrtd)) / a;
+            return real & (in_range((h - sqrtd) / a, root_slack)
+                           | in_range((h + sqrtd) / a, root_slack));
+        }
+    }
+
+    static void set_surface_point(
+        const ray& r, const point3& current_center, double radius, hit_record& rec
+    ) {
+        // Sets the point, normal and texture coordinates of the hit at rec.t. The point r.at(t)
+        // is off the sphere by the error in t, which grows with the distance the ray travels,
+        // so it's moved back onto the surface; that leaves only the rounding of these few
+        // operations in p.
+
+        vec3 outward_normal = unit_vector(r.at(rec.t) - current_center);
+        rec.p = current_center + radius * outward_normal;
+        rec.p_error = rounding_error(largest_magnitude(current_center) + radius);
+        rec.set_face_normal(r, outward_normal);
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+    }
+
+    static void get_sphere_uv(const point3& p, real& u, real& v) {
         // p: a given point on the sphere of radius one, centered at the origin.
         // u: returned value [0,1] of angle around the Y axis from X=-1.
         // v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -125,4 +253,134 @@ class sphere : public hittable {
 };
 
 
+
+constexpr int sphere_block_size = 8;  // Spheres per block, a multiple of every SIMD width
+
+
+class sphere_block {
+  // Up to sphere_block_size spheres stored side by side, one array per component with one
+  // lane per sphere, so that a ray is tested against all of them at once. Acceleration
+  // structures use blocks for leaves of nearby spheres in place of a virtual call per sphere.
+  // A block doesn't own its spheres' materials; the spheres it was made from must outlive it.
+  public:
+    bool add(const sphere& s) {
+        // Appends a copy of the sphere, or returns false if the block is full.
+        if (count == sphere_block_size)
+            return false;
+
+        auto k = count++;
+        center_x[k] = s.center.origin().x();
+        center_y[k] = s.center.origin().y();
+        center_z[k] = s.center.origin().z();
+        motion_x[k] = s.center.direction().x();
+        motion_y[k] = s.center.direction().y();
+        motion_z[k] = s.center.direction().z();
+        radius[k] = s.radius;
+        radius_squared[k] = s.radius * s.radius;
+        mat[k] = s.mat.get();
+        return true;
+    }
+
+    int size() const { return count; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        // Completes the candidates in order with sphere::hit's own scalar test, narrowing the
+        // range as it goes. That finds exactly the hit a loop over the spheres with
+        // sphere::hit would, even in builds where the scalar code rounds differently.
+
+        auto found = candidates(r, ray_t);
+        int nearest = -1;
+        point3 nearest_center;
+        for (int k = 0; k < count; k++) {
+            if (!(found & (1u << k)))
+                continue;
+
+            point3 current_center = current_center_of(k, r.time());
+            double root;
+            if (sphere::nearest_root(r, current_center, radius[k], ray_t, root)) {
+                rec.t = root;
+                ray_t.max = rec.t;
+                nearest = k;
+                nearest_center = current_center;
+            }
+        }
+
+        if (nearest < 0)
+            return false;
+
+        sphere::set_surface_point(r, nearest_center, radius[nearest], rec);
+        rec.mat = mat[nearest];
+
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const {
+        // Stops at the first candidate that sphere::hit's scalar test accepts.
+
+        auto found = candidates(r, ray_t);
+        for (int k = 0; k < count; k++) {
+            double root;
+            if ((found & (1u << k))
+                && sphere::nearest_root(r, current_center_of(k, r.time()), radius[k], ray_t,
+                                        root))
+                return true;
+        }
+        return false;
+    }
+
+  private:
+    double center_x[sphere_block_size] = {};
+    double center_y[sphere_block_size] = {};
+    double center_z[sphere_block_size] = {};
+    double motion_x[sphere_block_size] = {};  // Center movement over the shutter interval
+    double motion_y[sphere_block_size] = {};
+    double motion_z[sphere_block_size] = {};
+    double radius[sphere_block_size] = {};
+    double radius_squared[sphere_block_size] = {};
+    const material* mat[sphere_block_size] = {};
+    int count = 0;
+
+    uint32_t candidates(const ray& r, interval ray_t) const {
+        // The spheres whose quadratic, solved side by side as sphere::hit solves it, has a
+        // root in range: exactly those sphere::hit accepts, or a few more where it rounds
+        // differently.
+
+        auto time = vdouble::broadcast(r.time());
+        auto orig_x = vdouble::broadcast(r.origin().x());
+        auto orig_y = vdouble::broadcast(r.origin().y());
+        auto orig_z = vdouble::broadcast(r.origin().z());
+        auto dir_x = vdouble::broadcast(r.direction().x());
+        auto dir_y = vdouble::broadcast(r.direction().y());
+        auto dir_z = vdouble::broadcast(r.direction().z());
+        auto a = vdouble::broadcast(r.direction().length_squared());
+        auto origin_extent = abs(orig_x) + abs(orig_y) + abs(orig_z);
+        auto t_min = vdouble::broadcast(ray_t.min);
+        auto t_max = vdouble::broadcast(ray_t.max);
+
+        uint32_t found = 0;
+        for (int k = 0; k < count; k += vdouble::width) {
+            auto current_x = vdouble::load(center_x + k) + time * vdouble::load(motion_x + k);
+            auto current_y = vdouble::load(center_y + k) + time * vdouble::load(motion_y + k);
+            auto current_z = vdouble::load(center_z + k) + time * vdouble::load(motion_z + k);
+            auto oc_x = current_x - orig_x;
+            auto oc_y = current_y - orig_y;
+            auto oc_z = current_z - orig_z;
+
+            auto h = dir_x*oc_x + dir_y*oc_y + dir_z*oc_z;
+            auto oc_squared = oc_x*oc_x + oc_y*oc_y + oc_z*oc_z;
+            auto extent = abs(current_x) + abs(current_y) + abs(current_z) + origin_extent;
+            found |= sphere::root_in_range_mask(
+                a, h, oc_squared, vdouble::load(radius_squared + k), extent, t_min, t_max) << k;
+        }
+
+        return found & ((1u << count) - 1);
+    }
+
+    point3 current_center_of(int k, double time) const {
+        return point3(center_x[k], center_y[k], center_z[k])
+             + time * vec3(motion_x[k], motion_y[k], motion_z[k]);
+    }
+};
+
+
 #endif
@@ -1,5 +1,6 @@
 #include "rtweekend.h"
 
+#include "bvh.h"
 #include "camera.h"
 #include "constant_medium.h"
 #include "hittable_list.h"
@@ -62,6 +63,8 @@ int main() {
     world.add(make_shared<constant_medium>(fog_boundary, 0.001, color(1.0, 1.0, 1.0)));
 
 
+    world = hittable_list(make_shared<linear_bvh>(world));
+
     hittable_list lights;
     auto m = shared_ptr<material>();
     lights.add(make_shared<quad>(point3(-200, 554, -200), vec3(400,0,0), vec3(0,0,400), m));
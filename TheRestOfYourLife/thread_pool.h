@@ -0,0 +1,278 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class task_group {
+  // A set of tasks submitted to a thread pool that can be waited on as a unit.
+  public:
+    task_group() {}
+
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+  private:
+    friend class thread_pool;
+
+    std::atomic<int> pending{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+};
+
+
+class thread_pool {
+  // A fixed set of worker threads with one task deque per worker. Tasks submitted from outside
+  // the pool go to a shared queue; tasks submitted by a worker go to the back of its own deque.
+  // Workers run their own tasks newest first, then refill from the shared queue, and finally
+  // steal the oldest tasks from other workers, so uneven task costs balance out on their own.
+  public:
+    using task = std::function<void()>;
+
+    thread_pool(int thread_count = 0) {
+        if (thread_count <= 0)
+            thread_count = int(std::thread::hardware_concurrency());
+        if (thread_count <= 0)
+            thread_count = 1;
+
+        for (int i = 0; i < thread_count; i++)
+            queues.push_back(std::make_unique<work_queue>());
+
+        for (int i = 0; i < thread_count; i++)
+            workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const { return int(workers.size()); }
+
+    void run(task_group& group, task fn) {
+        // Schedules fn as part of the given group.
+
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+
+        push([this, &group, fn = std::move(fn)] {
+            fn();
+
+            // Decrement under the group lock, so a waiter can't destroy the group before the
+            // notification is finished.
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(group.mutex);
+                last = group.pending.fetch_sub(1, std::memory_order_acq_rel) == 1;
+                if (last)
+                    group.finished.notify_all();
+            }
+
+            // Workers waiting on a group sleep with the idle ones, so wake them all to check.
+            if (last) {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                if (waiting_workers > 0)
+                    wake.notify_all();
+            }
+        });
+    }
+
+    void wait(task_group& group) {
+        // Blocks until every task in the group has finished. When called from one of this
+        // pool's workers (nested parallelism), the caller keeps executing queued tasks instead,
+        // so it never deadlocks waiting on work stuck in its own deque. It only sleeps when
+        // there is nothing left to run, until more work arrives or some group finishes.
+
+        if (current_pool() == this) {
+            int self = current_index();
+            while (!group.done()) {
+                task next;
+                if (find_task(self, next)) {
+                    next();
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                waiting_workers++;
+                wake.wait(lock, [&] {
+                    return group.done() || queued.load(std::memory_order_acquire) > 0;
+                });
+                waiting_workers--;
+            }
+
+            // Let the final task release the group lock before the group can go away.
+            std::lock_guard<std::mutex> lock(group.mutex);
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(group.mutex);
+        group.finished.wait(lock, [&] { return group.done(); });
+    }
+
+    void parallel_for(
+        size_t count, size_t grain, const std::function<void(size_t, size_t)>& body
+    ) {
+        // Calls body(begin, end) over consecutive chunks of at most `grain` indices covering
+        // [0, count), and returns once all chunks are done. Chunk k always starts at k*grain.
+
+        if (grain == 0)
+            grain = 1;
+
+        task_group chunks;
+        for (size_t begin = 0; begin < count; begin += grain) {
+            auto end = std::min(begin + grain, count);
+            run(chunks, [&body, begin, end] { body(begin, end); });
+        }
+        wait(chunks);
+    }
+
+  private:
+    struct work_queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    static constexpr int refill_batch = 4;  // Tasks moved from the shared queue per refill
+
+    std::vector<std::unique_ptr<work_queue>> queues;
+    work_queue shared;
+    std::vector<std::thread> workers;
+
+    std::atomic<int> queued{0};  // Tasks sitting in any queue
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    int  waiting_workers = 0;  // Workers asleep in wait(), guarded by sleep_mutex
+    bool stopping = false;
+
+    static thread_pool*& current_pool() {
+        static thread_local thread_pool* pool = nullptr;
+        return pool;
+    }
+
+    static int& current_index() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    void push(task fn) {
+        if (current_pool() == this) {
+            auto& own = *queues[current_index()];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.tasks.push_back(std::move(fn));
+        } else {
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            shared.tasks.push_back(std::move(fn));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            queued.fetch_add(1, std::memory_order_release);
+        }
+        wake.notify_one();
+    }
+
+    bool find_task(int self, task& out) {
+        // Own deque first (newest task, best cache locality).
+        {
+            auto& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                out = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        // Then the shared queue, taking a few extra tasks along so other idle workers have
+        // something to steal from us near the end of a batch.
+        {
+            std::unique_lock<std::mutex> lock(shared.mutex);
+            if (!shared.tasks.empty()) {
+                out = std::move(shared.tasks.front());
+                shared.tasks.pop_front();
+
+                std::vector<task> extra;
+                while (!shared.tasks.empty() && int(extra.size()) < refill_batch - 1) {
+                    extra.push_back(std::move(shared.tasks.front()));
+                    shared.tasks.pop_front();
+                }
+                lock.unlock();
+
+                if (!extra.empty()) {
+                    auto& own = *queues[self];
+                    std::lock_guard<std::mutex> own_lock(own.mutex);
+                    for (auto& t : extra)
+                        own.tasks.push_front(std::move(t));
+                }
+
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        // Finally steal the oldest task from another worker.
+        int n = int(queues.size());
+        for (int k = 1; k < n; k++) {
+            auto& victim = *queues[(self + k) % n];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                out = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void worker_loop(int self) {
+        current_pool() = this;
+        current_index() = self;
+
+        while (true) {
+            task next;
+            if (find_task(self, next)) {
+                next();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [&] {
+                return stopping || queued.load(std::memory_order_acquire) > 0;
+            });
+            if (stopping && queued.load(std::memory_order_acquire) <= 0)
+                return;
+        }
+    }
+};
+
+
+#endif
@@ -11,45 +11,63 @@
 // along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==============================================================================================
 
+#if defined(RTW_SIMD_VEC3)
+#include "simd.h"
 
-class vec3 {
+#include <type_traits>
+#endif
+
+
+template <typename T>
+class basic_vec3 {
+  // A vector of three T, where T is float or double. The renderer uses it through the vec3,
+  // point3 and color aliases, which take the precision chosen for `real`.
+  //
+  // Built with -DRTW_SIMD_VEC3, the components are padded with a fourth that is always zero,
+  // and aligned, so that vec3 arithmetic loads, computes and stores whole vector registers.
   public:
-    double e[3];
+    using value_type = T;
+
+  #if defined(RTW_SIMD_VEC3)
+    alignas(4 * sizeof(T)) T e[4];
+  #else
+    T e[3];
+  #endif
 
-    vec3() : e{0,0,0} {}
-    vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+    basic_vec3() : e{0,0,0} {}
+    basic_vec3(T e0, T e1, T e2) : e{e0, e1, e2} {}
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    T x() const { return e[0]; }
+    T y() const { return e[1]; }
+    T z() const { return e[2]; }
 
-    vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double& operator[](int i) { return e[i]; }
+    basic_vec3 operator-() const { return basic_vec3(-e[0], -e[1], -e[2]); }
+    T operator[](int i) const { return e[i]; }
+    T& operator[](int i) { return e[i]; }
 
-    vec3& operator+=(const vec3& v) {
+    basic_vec3& operator+=(const basic_vec3& v) {
         e[0] += v.e[0];
         e[1] += v.e[1];
         e[2] += v.e[2];
         return *this;
     }
 
-    vec3& operator*=(double t) {
+    basic_vec3& operator*=(T t) {
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
         return *this;
     }
 
-    vec3& operator/=(double t) {
+    basic_vec3& operator/=(T t) {
         return *this *= 1/t;
     }
 
-    double length() const {
+    T length() const {
         return std::sqrt(length_squared());
     }
 
-    double length_squared() const {
+    T length_squared() const {
         return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
     }
 
@@ -59,58 +77,135 @@ class vec3 {
         return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s);
     }
 
-    static vec3 random() {
-        return vec3(random_double(), random_double(), random_double());
+    static basic_vec3 random() {
+        return basic_vec3(random_double(), random_double(), random_double());
     }
 
-    static vec3 random(double min, double max) {
-        return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
+    static basic_vec3 random(double min, double max) {
+        return basic_vec3(
+            random_double(min,max), random_double(min,max), random_double(min,max));
     }
 };
 
+// The scalar type of a vector, as a parameter type that doesn't take part in template argument
+// deduction: vec3 arithmetic accepts any scalar that converts to the vector's own type.
+template <typename T>
+using vec3_scalar = typename basic_vec3<T>::value_type;
+
+using vec3 = basic_vec3<real>;
+
 // point3 is just an alias for vec3, but useful for geometric clarity in the code.
 using point3 = vec3;
 
 
+#if defined(RTW_SIMD_VEC3)
+
+// Vector versions of the operations below for vec3 itself, which overload resolution picks
+// over the templates. All but unit_vector round exactly like the scalar code: dot sums its
+// products in the same order, and cross rotates its operands so that each lane computes the
+// same difference of products. unit_vector scales by reciprocal_sqrt, which in single
+// precision is a refined estimate, within a few units in the last place of 1/length.
+
+using vec3_lanes = std::conditional_t<std::is_same_v<real, float>, vfloat4, vdouble4>;
+
+inline vec3_lanes lanes(const vec3& v) { return vec3_lanes::load(v.e); }
+
+inline vec3 from_lanes(vec3_lanes l) {
+    vec3 v;
+    l.store(v.e);
+    return v;
+}
+
+template <>
+inline vec3& vec3::operator+=(const vec3& v) {
+    (lanes(*this) + lanes(v)).store(e);
+    return *this;
+}
+
+template <>
+inline vec3& vec3::operator*=(real t) {
+    (vec3_lanes::broadcast(t) * lanes(*this)).store(e);
+    return *this;
+}
+
+template <>
+inline real vec3::length_squared() const {
+    auto l = lanes(*this);
+    return sum3(l * l);
+}
+
+inline vec3 operator+(const vec3& u, const vec3& v) { return from_lanes(lanes(u) + lanes(v)); }
+inline vec3 operator-(const vec3& u, const vec3& v) { return from_lanes(lanes(u) - lanes(v)); }
+inline vec3 operator*(const vec3& u, const vec3& v) { return from_lanes(lanes(u) * lanes(v)); }
+
+inline vec3 operator*(real t, const vec3& v) {
+    return from_lanes(vec3_lanes::broadcast(t) * lanes(v));
+}
+
+inline vec3 operator*(const vec3& v, real t) { return t * v; }
+inline vec3 operator/(const vec3& v, real t) { return (1/t) * v; }
+
+inline real dot(const vec3& u, const vec3& v) { return sum3(lanes(u) * lanes(v)); }
+
+inline vec3 cross(const vec3& u, const vec3& v) {
+    // Lane by lane, u * v.yzx - u.yzx * v is (z, x, y) of the cross product.
+    auto a = lanes(u), b = lanes(v);
+    return from_lanes(rotate3(a * rotate3(b) - rotate3(a) * b));
+}
+
+inline vec3 unit_vector(const vec3& v) { return reciprocal_sqrt(v.length_squared()) * v; }
+
+#endif
+
+
 // Vector Utility Functions
 
-inline vec3 operator+(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator+(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
-inline vec3 operator-(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator-(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
-inline vec3 operator*(const vec3& u, const vec3& v) {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator*(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3& v) {
-    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator*(vec3_scalar<T> t, const basic_vec3<T>& v) {
+    return basic_vec3<T>(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
 
-inline vec3 operator*(const vec3& v, double t) {
+template <typename T>
+inline basic_vec3<T> operator*(const basic_vec3<T>& v, vec3_scalar<T> t) {
     return t * v;
 }
 
-inline vec3 operator/(const vec3& v, double t) {
+template <typename T>
+inline basic_vec3<T> operator/(const basic_vec3<T>& v, vec3_scalar<T> t) {
     return (1/t) * v;
 }
 
-inline double dot(const vec3& u, const vec3& v) {
+template <typename T>
+inline T dot(const basic_vec3<T>& u, const basic_vec3<T>& v) {
     return u.e[0] * v.e[0]
          + u.e[1] * v.e[1]
          + u.e[2] * v.e[2];
 }
 
-inline vec3 cross(const vec3& u, const vec3& v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+template <typename T>
+inline basic_vec3<T> cross(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                         u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                         u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline vec3 unit_vector(const vec3& v) {
+template <typename T>
+inline basic_vec3<T> unit_vector(const basic_vec3<T>& v) {
     return v / v.length();
 }
 
@@ -139,14 +234,18 @@ inline vec3 random_on_hemisphere(const vec3& normal) {
         return -on_unit_sphere;
 }
 
-inline vec3 reflect(const vec3& v, const vec3& n) {
+template <typename T>
+inline basic_vec3<T> reflect(const basic_vec3<T>& v, const basic_vec3<T>& n) {
     return v - 2*dot(v,n)*n;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
+template <typename T>
+inline basic_vec3<T> refract(
+    const basic_vec3<T>& uv, const basic_vec3<T>& n, vec3_scalar<T> etai_over_etat
+) {
     auto cos_theta = std::fmin(dot(-uv, n), 1.0);
-    vec3 r_out_perp =  etai_over_etat * (uv + cos_theta*n);
-    vec3 r_out_parallel = -std::sqrt(std::fabs(1.0 - r_out_perp.length_squared())) * n;
+    basic_vec3<T> r_out_perp =  etai_over_etat * (uv + cos_theta*n);
+    basic_vec3<T> r_out_parallel = -std::sqrt(std::fabs(1.0 - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
 
@@ -0,0 +1,172 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Compares the scalar vec3 with the SIMD one. Build it twice, once with -DRTW_SIMD_VEC3, and
+// run both from the same directory:
+//
+//     g++ -O2 -pthread vec3_bench.cc -o vec3_scalar
+//     g++ -O2 -pthread -DRTW_SIMD_VEC3 vec3_bench.cc -o vec3_simd
+//
+// (add -DRTW_FLOAT to both for single precision, or -mavx2 to keep double vectors in one
+// register). Each run times the core vector operations over arrays that fit in the cache,
+// reports how far unit_vector strays from dividing by the length, and times single-threaded
+// renders of the Cornell box from restLife.cc and the test.cc showcase (with a gray floor in
+// place of the rock texture). It saves the images, and when those of the other build are
+// there, reports how far apart the two are, next to the noise between two seeds of this one.
+
+#include "rtweekend.h"
+
+#include "bench_scenes.h"
+#include "bvh.h"
+#include "camera.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+#if defined(RTW_SIMD_VEC3)
+const char* build_name = "simd";
+const char* other_build_name = "scalar";
+#else
+const char* build_name = "scalar";
+const char* other_build_name = "simd";
+#endif
+
+
+// Operation timings
+
+const int array_size = 4096;
+const int passes = 4000;
+
+volatile double sink;
+
+
+template <typename Operation>
+void time_operation(const char* name, Operation operation) {
+    // Runs operation over every index of the arrays, passes times, and prints nanoseconds per
+    // call. Each pass feeds one of its results to sink so that none can be optimized away.
+    double best_seconds = infinity;
+    for (int trial = 0; trial < 3; trial++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < passes; pass++) {
+            double checksum = 0;
+            for (int i = 0; i < array_size; i++)
+                checksum += operation(i);
+            sink = checksum;
+        }
+        auto stop = std::chrono::steady_clock::now();
+        best_seconds = std::fmin(best_seconds,
+                                 std::chrono::duration<double>(stop - start).count());
+    }
+
+    auto calls = double(array_size) * passes;
+    std::cout << "  " << std::left << std::setw(12) << name << std::right << std::fixed
+              << std::setprecision(3) << std::setw(7) << 1e9 * best_seconds / calls << " ns\n";
+}
+
+
+void bench_operations() {
+    std::vector<vec3> a, b, normals, out(array_size);
+    for (int i = 0; i < array_size; i++) {
+        a.push_back(vec3::random(-10, 10));
+        b.push_back(vec3::random(-10, 10));
+        normals.push_back(random_unit_vector());
+    }
+
+    std::cout << "== operations (" << build_name << ", sizeof(vec3) " << sizeof(vec3) << ")\n";
+
+    // The operations that return a vector store it, so that the loop can't keep it in a
+    // register, and add one component to the checksum.
+    time_operation("add", [&](int i) { out[i] = a[i] + b[i]; return out[i].x(); });
+    time_operation("scale", [&](int i) { out[i] = b[i].y() * a[i]; return out[i].z(); });
+    time_operation("dot", [&](int i) { return dot(a[i], b[i]); });
+    time_operation("cross", [&](int i) { out[i] = cross(a[i], b[i]); return out[i].y(); });
+    time_operation("unit_vector", [&](int i) {
+        out[i] = unit_vector(a[i]);
+        return out[i].x();
+    });
+    time_operation("reflect", [&](int i) {
+        out[i] = reflect(a[i], normals[i]);
+        return out[i].z();
+    });
+
+    // The largest difference between a component of unit_vector(v) and that of v / |v|.
+    double largest_error = 0;
+    for (int i = 0; i < array_size; i++) {
+        auto unit = unit_vector(a[i]);
+        auto divided = a[i] / a[i].length();
+        for (int axis = 0; axis < 3; axis++) {
+            auto error = std::fabs(double(unit[axis]) - double(divided[axis]));
+            largest_error = std::fmax(largest_error, error);
+        }
+    }
+
+    auto epsilon = double(std::numeric_limits<real>::epsilon());
+    std::cout << "  unit_vector differs from v / |v| by at most " << std::setprecision(2)
+              << largest_error / epsilon << " epsilon\n\n";
+}
+
+
+// End-to-end renders
+
+void bench_render(bench_scene scene) {
+    scene.world = hittable_list(make_shared<linear_bvh>(scene.world));
+
+    auto& cam = scene.cam;
+    cam.samples_per_pixel = 32;
+    cam.max_depth         = 50;
+    cam.thread_count      = 1;
+    cam.integrator        = path_integrator::next_event;
+
+    std::vector<color> image;
+    double best_seconds = infinity;
+    for (int trial = 0; trial < 3; trial++) {
+        auto start = std::chrono::steady_clock::now();
+        image = cam.render_pixels(scene.world, scene.lights);
+        auto stop = std::chrono::steady_clock::now();
+        best_seconds = std::fmin(best_seconds,
+                                 std::chrono::duration<double>(stop - start).count());
+    }
+
+    camera reseeded = cam;
+    reseeded.seed = 1;
+    auto second_seed = reseeded.render_pixels(scene.world, scene.lights);
+
+    auto prefix = std::string("vec3_") + scene.file_name + '.';
+    save_image(prefix + build_name, image);
+
+    auto mean = mean_value(image);
+    auto samples = double(image.size()) * cam.samples_per_pixel;
+    std::cout << "== " << scene.name << '\n' << std::fixed << std::setprecision(3)
+              << build_name << ": " << samples / best_seconds / 1e6 << " Msamples/s   mean "
+              << std::setprecision(5) << mean << "   seed noise "
+              << mean_abs_difference(image, second_seed) << '\n';
+
+    std::vector<color> other;
+    if (!load_image(prefix + other_build_name, image.size(), other)) {
+        std::cout << "(no " << other_build_name << " images yet)\n\n";
+        return;
+    }
+
+    auto other_mean = mean_value(other);
+    std::cout << "vs " << other_build_name << ": mean " << other_mean << "   this "
+              << std::showpos << std::setprecision(3) << 100 * (mean - other_mean) / other_mean
+              << "%   " << std::noshowpos << std::setprecision(5) << "mean abs diff "
+              << mean_abs_difference(image, other) << "\n\n";
+}
+
+
+int main() {
+    bench_operations();
+    bench_render(cornell_box());
+    bench_render(showcase());
+}
@@ -0,0 +1,91 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Compares the throughput of the wavefront integrator with the depth-first ones on a single
+// thread, on the Cornell box from restLife.cc and on the test.cc showcase (with its fog, and
+// a gray floor in place of the rock texture). Each integrator renders the scene several times,
+// interleaved with the others, and keeps its best time. The wavefront integrator draws the
+// same numbers as the next event integrator, so it must render exactly the same image.
+
+#include "rtweekend.h"
+
+#include "bench_scenes.h"
+#include "bvh.h"
+#include "camera.h"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+struct configuration {
+    const char*        name;
+    path_integrator    integrator;
+    std::vector<color> image = {};
+    double best_seconds = infinity;
+    long long rays = 0;
+};
+
+
+void bench(bench_scene scene) {
+    scene.world = hittable_list(make_shared<linear_bvh>(scene.world));
+
+    auto& cam = scene.cam;
+    cam.samples_per_pixel = 64;
+    cam.max_depth         = 50;
+    cam.thread_count      = 1;
+
+    std::vector<configuration> configurations = {
+        { "recursive",  path_integrator::recursive },
+        { "next event", path_integrator::next_event },
+        { "wavefront",  path_integrator::wavefront },
+    };
+
+    for (int trial = 0; trial < 3; trial++) {
+        for (auto& config : configurations) {
+            camera c = cam;
+            c.integrator = config.integrator;
+
+            auto start = std::chrono::steady_clock::now();
+            config.image = c.render_pixels(scene.world, scene.lights);
+            auto stop = std::chrono::steady_clock::now();
+
+            auto seconds = std::chrono::duration<double>(stop - start).count();
+            config.best_seconds = std::fmin(config.best_seconds, seconds);
+            config.rays = c.last_statistics().rays;
+        }
+    }
+
+    const auto& next_event = configurations[1].image;
+    const auto& wavefront = configurations[2].image;
+    auto bytes = sizeof(color) * wavefront.size();
+    bool same = next_event.size() == wavefront.size()
+             && std::memcmp(next_event.data(), wavefront.data(), bytes) == 0;
+
+    auto pixels = double(next_event.size());
+    std::cout << "== " << scene.name << '\n';
+    for (const auto& config : configurations) {
+        auto samples = pixels * cam.samples_per_pixel;
+        std::cout << std::left << std::setw(12) << config.name << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(8) << samples / config.best_seconds / 1e6
+                  << " Msamples/s";
+        if (config.rays > 0)
+            std::cout << std::setw(8) << config.rays / config.best_seconds / 1e6 << " Mrays/s";
+        std::cout << '\n';
+    }
+    std::cout << "wavefront image " << (same ? "matches" : "DIFFERS FROM") << " next event\n\n";
+}
+
+
+int main() {
+    bench(cornell_box());
+    bench(showcase());
+}